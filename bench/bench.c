@@ -0,0 +1,668 @@
+/**
+ * Microbenchmarks of the building blocks of the search:
+ * the heap operations, the heuristics and the neighbour generation.
+ *
+ * Every benchmark is warmed up, then sampled several times. Samples
+ * outside of the interquartile fences are rejected, and the median of
+ * the rest is reported in ns per operation.
+ *
+ * With --scaling, it times instead whole queries over a big grid
+ * with the parallel search, from 1 thread up to the given number.
+ * With --cpd, it builds the path database of a cave grid with the
+ * given threads, and times its queries against find_path's, checking
+ * that its paths come back the same from the compact encoding.
+ * With --layout, it times long queries over a cave grid of the given
+ * side with each layout of the nodes, along with their cache and TLB
+ * misses, where the hardware counters can be read.
+ *
+ * Usage: path-finding-bench [--save <file>] [--compare <file>]
+ *                           [--threshold <pct>] [--filter <name>]
+ *                           [--scaling <max threads>] [--cpd <threads>]
+ *                           [--layout <side>]
+ */
+#include "heap.h"
+#include "heuristic.h"
+#include "path_finding.h"
+#include "generator.h"
+#include "parallel.h"
+#include "cpd.h"
+#include "path_code.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+
+#ifdef __linux__
+#    include <unistd.h>
+#    include <sys/ioctl.h>
+#    include <sys/syscall.h>
+#    include <linux/perf_event.h>
+#endif
+
+#define WARMUP_RUNS 3
+#define SAMPLES 21
+#define HEAP_SIZE 65536
+#define N_COORDS 4096
+#define HEURISTIC_ROUNDS 16
+#define GRID_SIDE 512
+#define MAX_BENCHMARKS 64
+#define DEFAULT_THRESHOLD 10.0
+#define SCALING_SIDE 2048
+#define SCALING_QUERIES 8
+#define CPD_SIDE 96
+#define CPD_QUERIES 2000
+#define LAYOUT_QUERIES 8
+
+extern int n_rows;
+extern int n_cols;
+
+// The search core expects these from the GUI
+bool animate_search = false;
+void take_step(){}
+
+static Node *nodes;
+static Heap heap;
+static Coordinates coords[N_COORDS];
+static int decrease_index[HEAP_SIZE];
+static double decrease_amount[HEAP_SIZE];
+static Rng rng;
+static volatile double sink;
+
+static double now_ns(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static double random_unit(){
+	return (rng_next(&rng) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static void randomize_nodes(){
+	for (int i = 0; i < HEAP_SIZE; i++){
+		nodes[i].g = random_unit() * 1000.0;
+		nodes[i].h = random_unit() * 1000.0;
+		nodes[i].heap_index = -1;
+	}
+	heap.n_elements = 0;
+}
+
+static void fill_heap(){
+	randomize_nodes();
+	for (int i = 0; i < HEAP_SIZE; i++){
+		heap_add(&heap, &nodes[i]);
+	}
+}
+
+/*
+ * Every benchmark prepares its input untimed, times its
+ * kernel, and returns the elapsed ns. ops is set to the
+ * number of operations performed.
+ */
+
+static double bench_heap_add(long *ops){
+	randomize_nodes();
+	double start = now_ns();
+	for (int i = 0; i < HEAP_SIZE; i++){
+		heap_add(&heap, &nodes[i]);
+	}
+	*ops = HEAP_SIZE;
+	return now_ns() - start;
+}
+
+static double bench_heap_pop(long *ops){
+	fill_heap();
+	double start = now_ns();
+	while (heap.n_elements > 0){
+		heap_pop(&heap);
+	}
+	*ops = HEAP_SIZE;
+	return now_ns() - start;
+}
+
+/*
+ * Like A* does, the keys only decrease, and by a small amount
+ * compared to f, so most nodes only climb a few levels.
+ */
+static double bench_heap_change_priority(long *ops){
+	fill_heap();
+	for (int i = 0; i < HEAP_SIZE; i++){
+		decrease_index[i] = rng_range(&rng, HEAP_SIZE);
+		decrease_amount[i] = 1.0 - random_unit() * 0.1;
+	}
+	double start = now_ns();
+	for (int i = 0; i < HEAP_SIZE; i++){
+		Node *node = &nodes[decrease_index[i]];
+		heap_change_priority(&heap, node, node->g * decrease_amount[i], node->h);
+	}
+	*ops = HEAP_SIZE;
+	return now_ns() - start;
+}
+
+static double bench_heuristic(heuristic_function heuristic, long *ops){
+	double sum = 0;
+	double start = now_ns();
+	for (int r = 0; r < HEURISTIC_ROUNDS; r++){
+		for (int i = 0; i < N_COORDS - 1; i++){
+			sum += heuristic(coords[i], coords[i + 1]);
+		}
+	}
+	double elapsed = now_ns() - start;
+	sink = sum;
+	*ops = (long)HEURISTIC_ROUNDS * (N_COORDS - 1);
+	return elapsed;
+}
+
+static double bench_manhatan(long *ops){
+	return bench_heuristic(heuristic_manhatan, ops);
+}
+
+static double bench_euclidean(long *ops){
+	return bench_heuristic(heuristic_euclidean, ops);
+}
+
+static double bench_diagonal(long *ops){
+	return bench_heuristic(heuristic_diagonal, ops);
+}
+
+static double bench_blind(long *ops){
+	return bench_heuristic(heuristic_blind, ops);
+}
+
+static double bench_get_children(long *ops){
+	Node *children[8];
+	long sum = 0;
+	double start = now_ns();
+	for (int i = 0; i < n_rows; i++){
+		for (int j = 0; j < n_cols; j++){
+			sum += get_children((Coordinates){j, i}, children);
+		}
+	}
+	double elapsed = now_ns() - start;
+	sink = sum;
+	*ops = (long)n_rows * n_cols;
+	return elapsed;
+}
+
+typedef struct Benchmark {
+	const char *name;
+	double (*run)(long *ops);
+} Benchmark;
+
+static const Benchmark benchmarks[] = {
+	{"heap_add", bench_heap_add},
+	{"heap_pop", bench_heap_pop},
+	{"heap_change_priority", bench_heap_change_priority},
+	{"heuristic_manhatan", bench_manhatan},
+	{"heuristic_euclidean", bench_euclidean},
+	{"heuristic_diagonal", bench_diagonal},
+	{"heuristic_blind", bench_blind},
+	{"get_children", bench_get_children},
+};
+
+#define N_BENCHMARKS (int)(sizeof(benchmarks) / sizeof(benchmarks[0]))
+
+typedef struct Result {
+	char name[64];
+	double ns_per_op;
+} Result;
+
+static int compare_doubles(const void *a, const void *b){
+	double x = *(const double*)a;
+	double y = *(const double*)b;
+	return (x > y) - (x < y);
+}
+
+/**
+ * Runs a benchmark and returns the median ns/op of the
+ * samples that are not outliers.
+ */
+static double measure(const Benchmark *b, double *spread, int *kept){
+	long ops;
+	for (int i = 0; i < WARMUP_RUNS; i++){
+		b->run(&ops);
+	}
+	double samples[SAMPLES];
+	for (int i = 0; i < SAMPLES; i++){
+		double elapsed = b->run(&ops);
+		samples[i] = elapsed / ops;
+	}
+	qsort(samples, SAMPLES, sizeof(double), compare_doubles);
+
+	double q1 = samples[SAMPLES / 4];
+	double q3 = samples[SAMPLES * 3 / 4];
+	double low = q1 - 1.5 * (q3 - q1);
+	double high = q3 + 1.5 * (q3 - q1);
+	double filtered[SAMPLES];
+	int n = 0;
+	for (int i = 0; i < SAMPLES; i++){
+		if (samples[i] >= low && samples[i] <= high){
+			filtered[n++] = samples[i];
+		}
+	}
+	*kept = n;
+	*spread = (filtered[n - 1] - filtered[0]) / 2;
+	return filtered[n / 2];
+}
+
+static int load_baseline(const char *filename, Result *results){
+	FILE *f = fopen(filename, "r");
+	if (!f){
+		return -1;
+	}
+	int n = 0;
+	while (n < MAX_BENCHMARKS && fscanf(f, "%63s %lf", results[n].name, &results[n].ns_per_op) == 2){
+		n++;
+	}
+	fclose(f);
+	return n;
+}
+
+static int save_baseline(const char *filename, const Result *results, int n){
+	FILE *f = fopen(filename, "w");
+	if (!f){
+		return -1;
+	}
+	for (int i = 0; i < n; i++){
+		fprintf(f, "%s %.4f\n", results[i].name, results[i].ns_per_op);
+	}
+	return fclose(f) == 0 ? 1 : -1;
+}
+
+/**
+ * Prints how every result compares to the baseline.
+ * Returns the number of regressions.
+ */
+static int compare_baseline(const Result *results, int n, const Result *baseline, int n_baseline, double threshold){
+	int regressions = 0;
+	printf("\n%-28s %12s %12s %9s\n", "benchmark", "baseline", "now", "change");
+	for (int i = 0; i < n; i++){
+		const Result *base = NULL;
+		for (int j = 0; j < n_baseline; j++){
+			if (strcmp(baseline[j].name, results[i].name) == 0){
+				base = &baseline[j];
+				break;
+			}
+		}
+		if (!base){
+			printf("%-28s %12s %12.2f\n", results[i].name, "-", results[i].ns_per_op);
+			continue;
+		}
+		double change = (results[i].ns_per_op / base->ns_per_op - 1.0) * 100.0;
+		const char *verdict = "";
+		if (change > threshold){
+			verdict = "  REGRESSION";
+			regressions++;
+		}else if (change < -threshold){
+			verdict = "  improved";
+		}
+		printf("%-28s %12.2f %12.2f %+8.1f%%%s\n", results[i].name,
+		       base->ns_per_op, results[i].ns_per_op, change, verdict);
+	}
+	return regressions;
+}
+
+static double path_cost(Path path){
+	double cost = 0;
+	for (int i = 1; i < path.path_length; i++){
+		int dx = path.path[i].x - path.path[i - 1].x;
+		int dy = path.path[i].y - path.path[i - 1].y;
+		cost += dx && dy ? M_SQRT2 : 1.0;
+	}
+	return cost;
+}
+
+static Coordinates random_free_cell(){
+	Coordinates c;
+	do{
+		c.x = rng_range(&rng, n_cols);
+		c.y = rng_range(&rng, n_rows);
+	}while (get_barrier(c));
+	return c;
+}
+
+/**
+ * Times long queries over a big cave grid, with the serial search
+ * and with the parallel one from 1 to max_threads threads (doubling).
+ * Every parallel path must cost the same as the serial one.
+ */
+static int scaling(int max_threads){
+	n_rows = SCALING_SIDE;
+	n_cols = SCALING_SIDE;
+	if (path_finding_init() != 1 || generate_map(GEN_CAVES, 1, 45, 1) != 1){
+		fprintf(stderr, "Error at path_finding_init\n");
+		return 1;
+	}
+	Coordinates starts[SCALING_QUERIES];
+	Coordinates goals[SCALING_QUERIES];
+	double costs[SCALING_QUERIES];
+	double serial = 0;
+	rng_seed(&rng, 1);
+	for (int i = 0; i < SCALING_QUERIES; i++){
+		// Only reachable pairs, at least half the grid apart
+		Path path;
+		do{
+			path.path_length = 0;
+			starts[i] = random_free_cell();
+			goals[i] = random_free_cell();
+			if (abs(starts[i].x - goals[i].x) + abs(starts[i].y - goals[i].y) < SCALING_SIDE / 2){
+				continue;
+			}
+			path = find_path(starts[i], goals[i], NULL, 1);
+		}while (path.path_length <= 1);
+		double start = now_ns();
+		path = find_path(starts[i], goals[i], NULL, 1);
+		serial += now_ns() - start;
+		costs[i] = path_cost(path);
+	}
+	printf("%-10s %12s %9s\n", "threads", "ms/query", "speedup");
+	printf("%-10s %12.2f %9s\n", "serial", serial / SCALING_QUERIES / 1e6, "1.00");
+
+	int status = 0;
+	for (int t = 1; t <= max_threads; t *= 2){
+		double elapsed = 0;
+		for (int i = 0; i < SCALING_QUERIES; i++){
+			double start = now_ns();
+			Path path = find_path_parallel(starts[i], goals[i], NULL, 1, t);
+			elapsed += now_ns() - start;
+			if (fabs(path_cost(path) - costs[i]) > 1e-6){
+				fprintf(stderr, "Query %d with %d threads costs %f instead of %f\n",
+					i, t, path_cost(path), costs[i]);
+				status = 1;
+			}
+		}
+		printf("%-10d %12.2f %9.2f\n", t, elapsed / SCALING_QUERIES / 1e6, serial / elapsed);
+		if (t < max_threads && t * 2 > max_threads){
+			t = max_threads / 2;
+		}
+	}
+	path_finding_free();
+	return status;
+}
+
+/**
+ * Whether path comes back the same from its encoding.
+ * cells must have room for it.
+ */
+static bool same_decoded(Path path, uint8_t *code, Coordinates *cells){
+	if (path.path_length == 0){
+		return true;
+	}
+	if (path_encode(path, code, path_code_size(path.path_length)) != 1
+	    || path_decode(path.path[0], code, path.path_length, cells, path.path_length) != 1){
+		return false;
+	}
+	return memcmp(cells, path.path, sizeof(Coordinates) * path.path_length) == 0;
+}
+
+/**
+ * Builds the path database of a cave grid, and times random queries
+ * with it and with find_path. Both paths must cost the same, and
+ * the encoding must keep them.
+ */
+static int cpd(int n_threads){
+	n_rows = CPD_SIDE;
+	n_cols = CPD_SIDE;
+	if (path_finding_init() != 1 || generate_map(GEN_CAVES, 1, 45, 1) != 1){
+		fprintf(stderr, "Error at path_finding_init\n");
+		return 1;
+	}
+	if (cpd_build(n_threads) != 1){
+		fprintf(stderr, "Error building the path database\n");
+		return 1;
+	}
+	CpdStats stats = cpd_stats();
+	printf("%dx%d grid, %d threads: built in %.2f s, %.2f MB, %.1f runs per source\n",
+	       n_rows, n_cols, n_threads, stats.build_seconds, stats.bytes / 1e6,
+	       (double)stats.n_runs / stats.n_sources);
+
+	Coordinates *cells = malloc(sizeof(Coordinates) * n_rows * n_cols);
+	uint8_t *code = malloc(path_code_size(n_rows * n_cols));
+	if (!cells || !code){
+		fprintf(stderr, "Out of memory\n");
+		return 1;
+	}
+	int status = 0;
+	double searched = 0;
+	double looked_up = 0;
+	rng_seed(&rng, 1);
+	for (int i = 0; i < CPD_QUERIES; i++){
+		Coordinates start = random_free_cell();
+		Coordinates goal = random_free_cell();
+		double t0 = now_ns();
+		Path path = find_path(start, goal, NULL, 1);
+		double t1 = now_ns();
+		double cost = path_cost(path);
+		path = find_path_cpd(start, goal);
+		looked_up += now_ns() - t1;
+		searched += t1 - t0;
+		if (fabs(path_cost(path) - cost) > 1e-6){
+			fprintf(stderr, "Query %d costs %f instead of %f\n", i, path_cost(path), cost);
+			status = 1;
+		}
+		if (!same_decoded(path, code, cells)){
+			fprintf(stderr, "Query %d changes with its encoding\n", i);
+			status = 1;
+		}
+	}
+	free(cells);
+	free(code);
+	printf("%-10s %12s\n", "", "us/query");
+	printf("%-10s %12.2f\n", "find_path", searched / CPD_QUERIES / 1e3);
+	printf("%-10s %12.2f\n", "cpd", looked_up / CPD_QUERIES / 1e3);
+	path_finding_free();
+	return status;
+}
+
+/**
+ * Opens a hardware counter of the calling thread, stopped.
+ * Returns -1 where they can't be read.
+ */
+static int open_counter(uint64_t config, bool cache){
+#ifdef __linux__
+	struct perf_event_attr attr = {
+		.type = cache ? PERF_TYPE_HW_CACHE : PERF_TYPE_HARDWARE,
+		.size = sizeof(attr),
+		.config = config,
+		.disabled = 1,
+		.exclude_kernel = 1,
+		.exclude_hv = 1,
+	};
+	return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+#else
+	(void) config;
+	(void) cache;
+	return -1;
+#endif
+}
+
+static void start_counter(int fd){
+#ifdef __linux__
+	if (fd >= 0){
+		ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+		ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+	}
+#else
+	(void) fd;
+#endif
+}
+
+static long stop_counter(int fd){
+	long long count = -1;
+#ifdef __linux__
+	if (fd >= 0){
+		ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+		if (read(fd, &count, sizeof(count)) != sizeof(count)){
+			count = -1;
+		}
+	}
+#else
+	(void) fd;
+#endif
+	return count;
+}
+
+static void print_count(long count, int n){
+	if (count < 0){
+		printf(" %14s", "n/a");
+	}else{
+		printf(" %14.0f", (double)count / n);
+	}
+}
+
+/**
+ * Times long queries over a side x side cave grid with each layout
+ * of the nodes. The queries are the same for all of them, and their
+ * paths must cost the same.
+ */
+static int layouts(int side){
+	static const char *names[] = {"rows", "blocked", "morton"};
+	Coordinates starts[LAYOUT_QUERIES];
+	Coordinates goals[LAYOUT_QUERIES];
+	double costs[LAYOUT_QUERIES];
+	n_rows = side;
+	n_cols = side;
+	int cache_misses = open_counter(PERF_COUNT_HW_CACHE_MISSES, false);
+	int tlb_misses = open_counter(PERF_COUNT_HW_CACHE_DTLB | PERF_COUNT_HW_CACHE_OP_READ << 8
+				      | PERF_COUNT_HW_CACHE_RESULT_MISS << 16, true);
+	printf("%dx%d caves, %d queries\n", side, side, LAYOUT_QUERIES);
+	printf("%-10s %12s %14s %14s\n", "layout", "ms/query", "cache misses", "dTLB misses");
+
+	int status = 0;
+	for (int l = 0; l < 3; l++){
+		layout_parse(names[l], &layout);
+		if (path_finding_init() != 1 || generate_map(GEN_CAVES, 1, 45, 1) != 1){
+			fprintf(stderr, "Error at path_finding_init\n");
+			return 1;
+		}
+		// Only reachable pairs, at least half the grid apart
+		rng_seed(&rng, 1);
+		for (int i = 0; l == 0 && i < LAYOUT_QUERIES; i++){
+			Path path;
+			do{
+				path.path_length = 0;
+				starts[i] = random_free_cell();
+				goals[i] = random_free_cell();
+				if (abs(starts[i].x - goals[i].x) + abs(starts[i].y - goals[i].y) < side / 2){
+					continue;
+				}
+				path = find_path(starts[i], goals[i], NULL, 1);
+			}while (path.path_length <= 1);
+			costs[i] = path_cost(path);
+		}
+		// Touches the nodes of every query once, like the first one did
+		for (int i = 0; l > 0 && i < LAYOUT_QUERIES; i++){
+			find_path(starts[i], goals[i], NULL, 1);
+		}
+
+		double elapsed = 0;
+		long cache = 0, tlb = 0;
+		for (int i = 0; i < LAYOUT_QUERIES; i++){
+			start_counter(cache_misses);
+			start_counter(tlb_misses);
+			double start = now_ns();
+			Path path = find_path(starts[i], goals[i], NULL, 1);
+			elapsed += now_ns() - start;
+			long c = stop_counter(cache_misses);
+			long t = stop_counter(tlb_misses);
+			cache = c < 0 || cache < 0 ? -1 : cache + c;
+			tlb = t < 0 || tlb < 0 ? -1 : tlb + t;
+			if (fabs(path_cost(path) - costs[i]) > 1e-6){
+				fprintf(stderr, "Query %d with the %s layout costs %f instead of %f\n",
+					i, names[l], path_cost(path), costs[i]);
+				status = 1;
+			}
+		}
+		printf("%-10s %12.2f", names[l], elapsed / LAYOUT_QUERIES / 1e6);
+		print_count(cache, LAYOUT_QUERIES);
+		print_count(tlb, LAYOUT_QUERIES);
+		printf("\n");
+		path_finding_free();
+	}
+	layout = LAYOUT_ROWS;
+	return status;
+}
+
+int main(int argc, char *argv[]){
+	const char *save_file = NULL;
+	const char *compare_file = NULL;
+	const char *filter = NULL;
+	double threshold = DEFAULT_THRESHOLD;
+	for (int i = 1; i < argc; i++){
+		if (strcmp(argv[i], "--save") == 0 && i + 1 < argc){
+			save_file = argv[++i];
+		}else if (strcmp(argv[i], "--compare") == 0 && i + 1 < argc){
+			compare_file = argv[++i];
+		}else if (strcmp(argv[i], "--threshold") == 0 && i + 1 < argc){
+			threshold = atof(argv[++i]);
+		}else if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc){
+			filter = argv[++i];
+		}else if (strcmp(argv[i], "--scaling") == 0 && i + 1 < argc){
+			return scaling(atoi(argv[++i]));
+		}else if (strcmp(argv[i], "--cpd") == 0 && i + 1 < argc){
+			return cpd(atoi(argv[++i]));
+		}else if (strcmp(argv[i], "--layout") == 0 && i + 1 < argc){
+			return layouts(atoi(argv[++i]));
+		}else{
+			fprintf(stderr, "Usage: %s [--save <file>] [--compare <file>] "
+				"[--threshold <pct>] [--filter <name>] [--scaling <max threads>] "
+				"[--cpd <threads>] [--layout <side>]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	n_rows = GRID_SIDE;
+	n_cols = GRID_SIDE;
+	if (path_finding_init() != 1){
+		fprintf(stderr, "Error at path_finding_init\n");
+		return 1;
+	}
+	nodes = calloc(HEAP_SIZE, sizeof(Node));
+	heap.elements = malloc(sizeof(Node*) * HEAP_SIZE);
+	if (!nodes || !heap.elements){
+		fprintf(stderr, "Out of memory\n");
+		return 1;
+	}
+	rng_seed(&rng, 1);
+	for (int i = 0; i < N_COORDS; i++){
+		coords[i].x = rng_range(&rng, GRID_SIDE);
+		coords[i].y = rng_range(&rng, GRID_SIDE);
+	}
+
+	Result results[MAX_BENCHMARKS];
+	int n_results = 0;
+	printf("%-28s %12s %10s %8s\n", "benchmark", "ns/op", "+/-", "samples");
+	for (int i = 0; i < N_BENCHMARKS; i++){
+		if (filter && !strstr(benchmarks[i].name, filter)){
+			continue;
+		}
+		double spread;
+		int kept;
+		double ns = measure(&benchmarks[i], &spread, &kept);
+		printf("%-28s %12.2f %10.2f %5d/%d\n", benchmarks[i].name, ns, spread, kept, SAMPLES);
+		snprintf(results[n_results].name, sizeof(results[n_results].name), "%s", benchmarks[i].name);
+		results[n_results++].ns_per_op = ns;
+	}
+
+	int status = 0;
+	if (compare_file){
+		Result baseline[MAX_BENCHMARKS];
+		int n_baseline = load_baseline(compare_file, baseline);
+		if (n_baseline < 0){
+			fprintf(stderr, "Can't read baseline %s\n", compare_file);
+			status = 1;
+		}else if (compare_baseline(results, n_results, baseline, n_baseline, threshold) > 0){
+			status = 1;
+		}
+	}
+	if (save_file && save_baseline(save_file, results, n_results) != 1){
+		fprintf(stderr, "Can't write baseline %s\n", save_file);
+		status = 1;
+	}
+
+	free(nodes);
+	free(heap.elements);
+	path_finding_free();
+	return status;
+}
@@ -0,0 +1,140 @@
+/**
+ * Arena allocator.
+ * The memory comes in chunks, each one at least as big as all the
+ * previous ones together, so an arena needs few of them to grow to
+ * any size. When it's reset with more than one, they are replaced
+ * by a single chunk of their total size, and from then on a reset
+ * is just rewinding it.
+ */
+#include "arena.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+// Every allocation is aligned to this
+#define ARENA_ALIGN 16
+#define ARENA_MIN_CHUNK (64 * 1024)
+
+struct ArenaChunk {
+	ArenaChunk *next;
+	size_t capacity;
+	_Alignas(ARENA_ALIGN) unsigned char data[];
+};
+
+// Highest high water mark of every arena
+static atomic_size_t peak = 0;
+
+static inline size_t align_up(size_t n){
+	return (n + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+}
+
+static void update_high_water(Arena *arena){
+	if (arena->allocated <= arena->high_water){
+		return;
+	}
+	arena->high_water = arena->allocated;
+	size_t old = atomic_load(&peak);
+	while (old < arena->high_water && !atomic_compare_exchange_weak(&peak, &old, arena->high_water));
+}
+
+static ArenaChunk* new_chunk(size_t capacity, ArenaChunk *next){
+	ArenaChunk *chunk = malloc(sizeof(ArenaChunk) + capacity);
+	if (!chunk){
+		return NULL;
+	}
+	chunk->next = next;
+	chunk->capacity = capacity;
+	return chunk;
+}
+
+/**
+ * Returns size bytes from the arena, or NULL if it can't grow.
+ * They are valid until the arena is reset.
+ */
+void* arena_alloc(Arena *arena, size_t size){
+	size = align_up(size);
+	if (!arena->chunk || arena->chunk->capacity - arena->used < size){
+		size_t capacity = arena->size > ARENA_MIN_CHUNK ? arena->size : ARENA_MIN_CHUNK;
+		if (capacity < size){
+			capacity = size;
+		}
+		ArenaChunk *chunk = new_chunk(capacity, arena->chunk);
+		if (!chunk){
+			return NULL;
+		}
+		arena->chunk = chunk;
+		arena->used = 0;
+		arena->size += capacity;
+	}
+	void *p = arena->chunk->data + arena->used;
+	arena->used += size;
+	arena->allocated += size;
+	arena->last = p;
+	update_high_water(arena);
+	return p;
+}
+
+/**
+ * Grows p, allocated from the arena with old_size bytes, to new_size.
+ * The last allocation grows in place if it fits, any other one is
+ * copied. Returns NULL, with p untouched, if the arena can't grow.
+ */
+void* arena_grow(Arena *arena, void *p, size_t old_size, size_t new_size){
+	if (!p){
+		return arena_alloc(arena, new_size);
+	}
+	old_size = align_up(old_size);
+	new_size = align_up(new_size);
+	if (new_size <= old_size){
+		return p;
+	}
+	if (p == arena->last && arena->chunk->capacity - arena->used >= new_size - old_size){
+		arena->used += new_size - old_size;
+		arena->allocated += new_size - old_size;
+		update_high_water(arena);
+		return p;
+	}
+	void *q = arena_alloc(arena, new_size);
+	if (q){
+		memcpy(q, p, old_size);
+	}
+	return q;
+}
+
+/**
+ * Frees everything allocated from the arena, but keeps its memory.
+ */
+void arena_reset(Arena *arena){
+	if (arena->chunk && arena->chunk->next){
+		size_t size = arena->size;
+		arena_free(arena);
+		// If it can't be merged, it's allocated again on demand
+		if ((arena->chunk = new_chunk(size, NULL))){
+			arena->size = size;
+		}
+	}
+	arena->used = 0;
+	arena->allocated = 0;
+	arena->last = NULL;
+}
+
+void arena_free(Arena *arena){
+	ArenaChunk *chunk = arena->chunk;
+	while (chunk){
+		ArenaChunk *next = chunk->next;
+		free(chunk);
+		chunk = next;
+	}
+	size_t high_water = arena->high_water;
+	*arena = (Arena){0};
+	arena->high_water = high_water;
+}
+
+/**
+ * Returns the most memory that any arena has handed out between
+ * two resets: what the searches need for scratch at most.
+ */
+size_t arena_peak(void){
+	return atomic_load(&peak);
+}
@@ -0,0 +1,30 @@
+/**
+ * Arena allocator for the scratch memory of the searches.
+ * Everything is freed at once by arena_reset, which keeps the
+ * memory for the next search, so once an arena has grown to the
+ * size of the searches it serves, they don't allocate anymore.
+ */
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+typedef struct ArenaChunk ArenaChunk;
+
+typedef struct Arena {
+	ArenaChunk *chunk;   // Where the allocations go, the older ones follow it
+	size_t used;         // Of the current chunk
+	size_t size;         // Of every chunk together
+	size_t allocated;    // Since the last reset
+	size_t high_water;   // Most allocated between two resets
+	void *last;          // Last allocation, the only one that grows in place
+} Arena;
+
+void* arena_alloc(Arena *arena, size_t size);
+void* arena_grow(Arena *arena, void *p, size_t old_size, size_t new_size);
+void arena_reset(Arena *arena);
+void arena_free(Arena *arena);
+
+size_t arena_peak(void);
+
+#endif // ARENA_H
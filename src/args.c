@@ -2,6 +2,8 @@
 #include <stdlib.h>
 #include "heuristic.h"
 #include "path_finding.h"
+#include "generator.h"
+#include "clearance.h"
 #include <string.h>
 
 #define CELL_WIDTH 20
@@ -13,6 +15,27 @@ int window_width;
 int window_height;
 
 heuristic_function heuristic = NULL;
+double weight = 1.0;
+int time_budget = 0;
+int agent_size = 1;
+int search_threads = 1;
+
+bool generate = false;
+generator_family family = GEN_UNIFORM;
+int density = RANDOM_BARRIERS_DENSITY;
+char *export_prefix = NULL;
+int n_scenarios = 100;
+char *snapshot_in = NULL;
+char *snapshot_out = NULL;
+char *serve_socket = NULL;
+int n_workers = 0;
+int cpd_threads = 0;
+bool use_subgoals = false;
+bool any_angle = false;
+bool snapshot_check = false;
+char *session_in = NULL;
+char *session_out = NULL;
+char *trace_out = NULL;
 
 static void help(void);
 
@@ -61,22 +84,203 @@ void args_parse(int argc, char *argv[]) {
 						        "- diagonal\n");
 					exit(1);
 				}
-				if (strcmp(argv[++i], "blind") == 0){
-					heuristic = heuristic_blind;
+				heuristic = heuristic_from_name(argv[++i]);
+				if (!heuristic){
+					fprintf(stderr, "Invalid argument to --heuristic: %s\n", argv[i]);
+					exit(1);
 				}
-				else if (strcmp(argv[i], "manhatan") == 0){
-					heuristic = heuristic_manhatan;
+			}
+			else if(strcmp(&argv[i][2], "weight") == 0){
+				if (argc <= i+1){
+					fprintf(stderr, "Missing argument to --weight\n");
+					exit(1);
 				}
-				else if (strcmp(argv[i], "euclidean") == 0){
-					heuristic = heuristic_euclidean;
+				weight = atof(argv[++i]);
+				if (weight < 1.0){
+					fprintf(stderr, "The weight must be at least 1.0\n");
+					exit(1);
 				}
-				else if (strcmp(argv[i], "diagonal") == 0){
-					heuristic = heuristic_diagonal;
+			}
+			else if(strcmp(&argv[i][2], "anytime") == 0){
+				if (argc <= i+1){
+					fprintf(stderr, "Missing argument to --anytime\n");
+					exit(1);
 				}
-				else{
-					fprintf(stderr, "Invalid argument to --heuristic: %s\n", argv[i]);
+				time_budget = atoi(argv[++i]);
+				if (time_budget <= 0){
+					fprintf(stderr, "The time budget must be positive\n");
+					exit(1);
+				}
+			}
+			else if(strcmp(&argv[i][2], "agent-size") == 0){
+				if (argc <= i+1){
+					fprintf(stderr, "Missing argument to --agent-size\n");
+					exit(1);
+				}
+				agent_size = atoi(argv[++i]);
+				if (agent_size <= 0 || agent_size > AGENT_SIZE_MAX){
+					fprintf(stderr, "The agent size must be from 1 to %d\n", AGENT_SIZE_MAX);
+					exit(1);
+				}
+			}
+			else if(strcmp(&argv[i][2], "parallel") == 0){
+				if (argc <= i+1){
+					fprintf(stderr, "Missing argument to --parallel\n");
+					exit(1);
+				}
+				search_threads = atoi(argv[++i]);
+				if (search_threads <= 0){
+					fprintf(stderr, "The number of threads must be positive\n");
+					exit(1);
+				}
+			}
+			else if(strcmp(&argv[i][2], "generate") == 0){
+				if (argc <= i+1){
+					fprintf(stderr, "Available:\n"
+						        "- random\n"
+						        "- rooms\n"
+						        "- maze\n"
+						        "- caves\n");
+					exit(1);
+				}
+				if (generator_parse_family(argv[++i], &family) != 1){
+					fprintf(stderr, "Invalid argument to --generate: %s\n", argv[i]);
+					exit(1);
+				}
+				generate = true;
+			}
+			else if(strcmp(&argv[i][2], "layout") == 0){
+				if (argc <= i+1){
+					fprintf(stderr, "Available:\n"
+						        "- rows\n"
+						        "- blocked\n"
+						        "- morton\n");
+					exit(1);
+				}
+				if (layout_parse(argv[++i], &layout) != 1){
+					fprintf(stderr, "Invalid argument to --layout: %s\n", argv[i]);
+					exit(1);
+				}
+			}
+			else if(strcmp(&argv[i][2], "seed") == 0){
+				if (argc <= i+1){
+					fprintf(stderr, "Missing argument to --seed\n");
+					exit(1);
+				}
+				generator_seed = strtoull(argv[++i], NULL, 10);
+			}
+			else if(strcmp(&argv[i][2], "density") == 0){
+				if (argc <= i+1){
+					fprintf(stderr, "Missing argument to --density\n");
+					exit(1);
+				}
+				density = atoi(argv[++i]);
+				if (density < 0 || density > 100){
+					fprintf(stderr, "The density must be a percentage\n");
+					exit(1);
+				}
+			}
+			else if(strcmp(&argv[i][2], "threads") == 0){
+				if (argc <= i+1){
+					fprintf(stderr, "Missing argument to --threads\n");
+					exit(1);
+				}
+				generator_threads = atoi(argv[++i]);
+				if (generator_threads <= 0){
+					fprintf(stderr, "The number of threads must be positive\n");
+					exit(1);
+				}
+			}
+			else if(strcmp(&argv[i][2], "export") == 0){
+				if (argc <= i+1){
+					fprintf(stderr, "Missing argument to --export\n");
+					exit(1);
+				}
+				export_prefix = argv[++i];
+			}
+			else if(strcmp(&argv[i][2], "scenarios") == 0){
+				if (argc <= i+1){
+					fprintf(stderr, "Missing argument to --scenarios\n");
+					exit(1);
+				}
+				n_scenarios = atoi(argv[++i]);
+				if (n_scenarios < 0){
+					fprintf(stderr, "The number of scenarios can't be negative\n");
+					exit(1);
+				}
+			}
+			else if(strcmp(&argv[i][2], "load") == 0){
+				if (argc <= i+1){
+					fprintf(stderr, "Missing argument to --load\n");
+					exit(1);
+				}
+				snapshot_in = argv[++i];
+			}
+			else if(strcmp(&argv[i][2], "verify") == 0){
+				snapshot_check = true;
+			}
+			else if(strcmp(&argv[i][2], "save") == 0){
+				if (argc <= i+1){
+					fprintf(stderr, "Missing argument to --save\n");
+					exit(1);
+				}
+				snapshot_out = argv[++i];
+			}
+			else if(strcmp(&argv[i][2], "serve") == 0){
+				if (argc <= i+1){
+					fprintf(stderr, "Missing argument to --serve\n");
+					exit(1);
+				}
+				serve_socket = argv[++i];
+			}
+			else if(strcmp(&argv[i][2], "workers") == 0){
+				if (argc <= i+1){
+					fprintf(stderr, "Missing argument to --workers\n");
+					exit(1);
+				}
+				n_workers = atoi(argv[++i]);
+				if (n_workers <= 0){
+					fprintf(stderr, "The number of workers must be positive\n");
+					exit(1);
+				}
+			}
+			else if(strcmp(&argv[i][2], "subgoals") == 0){
+				use_subgoals = true;
+			}
+			else if(strcmp(&argv[i][2], "any-angle") == 0){
+				any_angle = true;
+			}
+			else if(strcmp(&argv[i][2], "cpd") == 0){
+				if (argc <= i+1){
+					fprintf(stderr, "Missing argument to --cpd\n");
+					exit(1);
+				}
+				cpd_threads = atoi(argv[++i]);
+				if (cpd_threads <= 0){
+					fprintf(stderr, "The number of threads must be positive\n");
+					exit(1);
+				}
+			}
+			else if(strcmp(&argv[i][2], "record") == 0){
+				if (argc <= i+1){
+					fprintf(stderr, "Missing argument to --record\n");
+					exit(1);
+				}
+				session_out = argv[++i];
+			}
+			else if(strcmp(&argv[i][2], "replay") == 0){
+				if (argc <= i+1){
+					fprintf(stderr, "Missing argument to --replay\n");
+					exit(1);
+				}
+				session_in = argv[++i];
+			}
+			else if(strcmp(&argv[i][2], "trace") == 0){
+				if (argc <= i+1){
+					fprintf(stderr, "Missing argument to --trace\n");
 					exit(1);
 				}
+				trace_out = argv[++i];
 			}
 			else if(strcmp(&argv[i][2], "help") == 0){
 				help();
@@ -126,14 +330,47 @@ static void help(void) {
 		"\t-d <n_rows>x<n_cols> : Set dimensions for the grid\n"
 		"\t-w <width> : Set width of grid's cells\n"
 		"\t--heuristic <name>: Set the heuristic to use\n"
+		"\t--weight <w>: Inflate the heuristic by w (weighted A*)\n"
+		"\t--anytime <ms>: Keep improving the weighted path for ms milliseconds\n"
+		"\t--agent-size <n>: Find paths for an agent n cells wide, up to 63\n"
+		"\t--parallel <n>: Search with n threads. Not animated, and\n"
+		"\t                ignored with --weight and --anytime\n"
 		"\t--size [small|medium|large]: Set the size of the grid\n"
+		"\t--layout [rows|blocked|morton]: Order of the search nodes in memory\n"
+		"\t--generate [random|rooms|maze|caves]: Start with a generated grid\n"
+		"\t--seed <n>: Seed of the generator. The clock is used by default\n"
+		"\t--density <pct>: Percentage of barriers of random and caves grids\n"
+		"\t--threads <n>: Number of threads used to generate grids\n"
+		"\t--export <prefix>: Write the grid to <prefix>.map and the scenarios\n"
+		"\t                   to <prefix>.map.scen, and exit\n"
+		"\t--scenarios <n>: Number of scenarios written by --export (100)\n"
+		"\t--load <file>: Load the grid from a snapshot\n"
+		"\t--verify: Check the whole snapshot of --load, and its path database\n"
+		"\t--save <file>: Save the grid to a snapshot, and exit\n"
+		"\t--serve <socket|->: Answer path queries on a Unix socket, or on\n"
+		"\t                    stdin and stdout, without a window\n"
+		"\t--workers <n>: Number of threads of --serve (one per CPU)\n"
+		"\t--subgoals: Search 8-connected paths on a subgoal graph\n"
+		"\t--any-angle: Find paths of straight segments at any angle\n"
+		"\t--cpd <n>: Build a compressed path database with n threads,\n"
+		"\t           for fast queries on grids that don't change\n"
+		"\t--record <file>: Record the edits and searches of the session\n"
+		"\t--replay <file>: Replay a recorded session without a window, and\n"
+		"\t                 print the latency of each kind of request\n"
+		"\t--trace <file>: Write a timeline of the searches and the drawing to\n"
+		"\t                file on exit, in the Chrome trace format\n"
 		"Keybindings:\n"
 		"\t A: Display a search animation while traversing the grid\n"
 		"\t V: Color the blocks which have been visited during the search.\n"
 		"\t R: Generate a grid with random obstacles\n"
 		"\t M: Fill all the grid with obstacles, so you can draw a maze.\n"
-		"\t C: Clear the grid.\n"
+		"\t C: Clear the grid, barriers and costs.\n"
 		"\t T: Switch between dark and light theme\n"
 		"\t H: Toggle horizontal movement on and off\n"
-		"\t F5: Redraw path\n");
+		"\t 1-9: Paint cells of that cost with the right click\n"
+		"\t 0: Put barriers with the right click again\n"
+		"\t F5: Redraw path\n"
+		"\t Mouse wheel, + and -: Zoom in and out\n"
+		"\t Middle click drag, arrow keys: Move around the grid\n"
+		"\t Home: Show the whole grid\n");
 }
@@ -1,7 +1,9 @@
 #ifndef ARGS_H
 #define ARGS_H
 
+#include <stdbool.h>
 #include "heuristic.h"
+#include "generator.h"
 
 extern int n_cols;
 extern int n_rows;
@@ -9,6 +11,26 @@ extern int grid_cell_size;
 extern int window_width;
 extern int window_height;
 extern heuristic_function heuristic;
+extern double weight;
+extern int time_budget;
+extern int agent_size;
+extern int search_threads;
+extern bool generate;
+extern generator_family family;
+extern int density;
+extern char *export_prefix;
+extern int n_scenarios;
+extern char *snapshot_in;
+extern char *snapshot_out;
+extern char *serve_socket;
+extern int n_workers;
+extern int cpd_threads;
+extern bool use_subgoals;
+extern bool any_angle;
+extern bool snapshot_check;
+extern char *session_in;
+extern char *session_out;
+extern char *trace_out;
 
 void args_parse(int argc, char *argv[]);
 
@@ -0,0 +1,88 @@
+/**
+ * Clearance map of the grid.
+ * It's computed with a two pass chessboard distance transform: the
+ * first pass propagates the distances down and right, the second one
+ * up and left. A change to a single cell can only affect the cells
+ * closer than CLEARANCE_MAX to it, so only that window is recomputed.
+ */
+#include "clearance.h"
+#include "grid.h"
+
+extern int n_rows;
+extern int n_cols;
+
+static inline int at(int x, int y){
+	if (x < 0 || x >= n_cols || y < 0 || y >= n_rows){
+		return 0;
+	}
+	return clearance_get(x, y);
+}
+
+static inline int min(int a, int b){
+	return a < b ? a : b;
+}
+
+static inline int max(int a, int b){
+	return a > b ? a : b;
+}
+
+/**
+ * Recomputes the clearance of the cells in [x0, x1) x [y0, y1).
+ * The cells around it are read but not written, so they must
+ * already be right.
+ */
+static void transform(int x0, int y0, int x1, int y1){
+	for (int y = y0; y < y1; y++){
+		uint8_t *row = grid_layer_row_mut(GRID_CLEARANCE, y);
+		for (int x = x0; x < x1; x++){
+			if (grid_get(x, y)){
+				row[x] = 0;
+				continue;
+			}
+			int d = min(min(at(x - 1, y), at(x - 1, y - 1)),
+				    min(at(x, y - 1), at(x + 1, y - 1))) + 1;
+			row[x] = min(d, CLEARANCE_MAX);
+		}
+	}
+	for (int y = y1 - 1; y >= y0; y--){
+		uint8_t *row = grid_layer_row_mut(GRID_CLEARANCE, y);
+		for (int x = x1 - 1; x >= x0; x--){
+			if (row[x] == 0){
+				continue;
+			}
+			int d = min(min(at(x + 1, y), at(x + 1, y + 1)),
+				    min(at(x, y + 1), at(x - 1, y + 1))) + 1;
+			if (d < row[x]){
+				row[x] = d;
+			}
+		}
+	}
+}
+
+/**
+ * Builds the map from the barriers, unless it came
+ * attached to the grid, from a snapshot.
+ */
+int clearance_init(void){
+	if (!grid_attached(GRID_CLEARANCE)){
+		clearance_build();
+	}
+	return 1;
+}
+
+/**
+ * Rebuilds the whole map. Used after editing many cells at once.
+ */
+void clearance_build(void){
+	transform(0, 0, n_cols, n_rows);
+	grid_touch();
+}
+
+/**
+ * Updates the map after the cell (x, y) has changed.
+ */
+void clearance_update(int x, int y){
+	int r = CLEARANCE_MAX - 1;
+	grid_touch();
+	transform(max(x - r, 0), max(y - r, 0), min(x + r + 1, n_cols), min(y + r + 1, n_rows));
+}
@@ -0,0 +1,52 @@
+/**
+ * Clearance map of the grid.
+ * One byte per cell with the chessboard distance to the closest
+ * barrier, counting the outside of the grid as barriers. Barriers
+ * have 0, and the cells next to them 1. It's capped at CLEARANCE_MAX.
+ */
+#ifndef CLEARANCE_H
+#define CLEARANCE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "grid.h"
+
+// Also bounds the area recomputed when a single cell changes
+#define CLEARANCE_MAX 32
+// Widest agent the map can tell cells apart for
+#define AGENT_SIZE_MAX (2 * CLEARANCE_MAX - 1)
+
+/**
+ * Clearance of a cell in the given version of the grid. Loops that
+ * call functions can keep the version in a local, since grid_view
+ * would be reloaded after each call.
+ */
+static inline int clearance_in(const GridVersion *view, int x, int y){
+	return view->rows[GRID_CLEARANCE][y >> GRID_BAND_BITS][(long)(y & GRID_BAND_MASK) * n_cols + x];
+}
+
+static inline int clearance_get(int x, int y){
+	return clearance_in(grid_view, x, y);
+}
+
+/**
+ * Clearance a cell needs to hold an agent of the given size.
+ * The agent covers the size x size square centered on its cell,
+ * so even sizes are rounded up to the next odd one. Agents wider
+ * than AGENT_SIZE_MAX are handled as if they were that wide, so the
+ * options and requests reject them.
+ */
+static inline int clearance_needed(int agent_size){
+	if (agent_size < 1){
+		agent_size = 1;
+	}
+	int needed = agent_size / 2 + 1;
+	return needed > CLEARANCE_MAX ? CLEARANCE_MAX : needed;
+}
+
+int clearance_init(void);
+
+void clearance_build(void);
+void clearance_update(int x, int y);
+
+#endif // CLEARANCE_H
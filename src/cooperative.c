@@ -0,0 +1,509 @@
+/**
+ * Cooperative path finding (HCA* and its windowed version, WHCA*).
+ * The agents are planned one after another. Each one searches in
+ * space and time, where waiting is a move too, and avoids the cells
+ * (and swaps) reserved by the agents planned before it. Then it
+ * reserves its own path. An agent that reaches its goal stays there,
+ * so the goal is taken from then on.
+ *
+ * The heuristic is the true distance to the goal on the grid without
+ * agents, found by a breadth first search from the goal (RRA*). It's
+ * only expanded as far as the searches need, and kept per goal, so
+ * the agents that share a goal, or the same agents on the next tick,
+ * don't search it again.
+ */
+#include "cooperative.h"
+#include "heap.h"
+#include "grid.h"
+#include "arena.h"
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+extern int n_rows;
+extern int n_cols;
+extern bool horizontal_movement;
+
+#define MIN_TABLE_SIZE 1024
+// Memory for the distances of all the goals kept
+#define HEURISTIC_CACHE_BYTES (256L << 20)
+#define MAX_CACHED_GOALS 256
+// Steps an agent can wait for others, besides its
+// distance to the goal, when the search is not windowed
+#define TIME_SLACK 32
+#define UNKNOWN -1
+#define UNREACHABLE INT_MAX
+#define NO_AGENT -1
+
+// The first one is waiting
+static const int moves[9][2] = {
+	{0, 0}, {-1, 0}, {1, 0}, {0, 1}, {0, -1},
+	{-1, 1}, {-1, -1}, {1, 1}, {1, -1}
+};
+
+typedef struct GoalDistances {
+	int goal;               // Cell, -1 if the entry is free
+	unsigned long version;  // grid_version() they were found with
+	int *dist;
+	int *queue;
+	int head;
+	int tail;
+} GoalDistances;
+
+typedef struct Reservation {
+	uint64_t key;  // 0 if the slot is empty
+	int agent;
+} Reservation;
+
+typedef struct NodeSlot {
+	uint64_t key;
+	unsigned stamp;  // The slot is empty unless it's the current one
+	Node *node;
+} NodeSlot;
+
+typedef struct CellState {
+	int parked;         // Agent that stays here, or NO_AGENT
+	int parked_from;
+	int last_reserved;  // Latest time it's reserved, -1 if never
+} CellState;
+
+// Heuristic
+static _Thread_local GoalDistances *cache;
+static _Thread_local int cache_size;
+static _Thread_local int cache_next;
+
+// Reservations of the current plan
+static _Thread_local Reservation *table;
+static _Thread_local size_t table_size;
+static _Thread_local size_t table_used;
+static _Thread_local CellState *cells;
+static _Thread_local int *touched;
+static _Thread_local int n_touched;
+
+// Search of a single agent
+static _Thread_local Arena pool;
+static _Thread_local NodeSlot *slots;
+static _Thread_local size_t slots_size;
+static _Thread_local size_t slots_used;
+static _Thread_local unsigned stamp;
+static _Thread_local Heap open;
+static _Thread_local int open_size;
+
+// Paths of the current plan
+static _Thread_local Coordinates *steps;
+static _Thread_local size_t steps_size;
+
+static inline uint64_t hash(uint64_t key){
+	key ^= key >> 33;
+	key *= 0xFF51AFD7ED558CCDULL;
+	key ^= key >> 33;
+	return key;
+}
+
+static inline uint64_t space_time(int cell, int t){
+	return ((uint64_t)t << 32 | (uint32_t)cell) + 1;
+}
+
+/**
+ * Returns the distances to the goal, reusing the ones
+ * kept if they are still up to date.
+ */
+static GoalDistances* goal_distances(int goal){
+	for (int i = 0; i < cache_size; i++){
+		if (cache[i].goal == goal && cache[i].version == grid_version()){
+			return &cache[i];
+		}
+	}
+	GoalDistances *d = &cache[cache_next];
+	cache_next = (cache_next + 1) % cache_size;
+	if (!d->dist){
+		d->dist = malloc(sizeof(int) * n_rows * n_cols);
+		d->queue = malloc(sizeof(int) * n_rows * n_cols);
+		if (!d->dist || !d->queue){
+			free(d->dist);
+			free(d->queue);
+			d->dist = NULL;
+			d->queue = NULL;
+			return NULL;
+		}
+	}
+	d->goal = goal;
+	d->version = grid_version();
+	memset(d->dist, 0xFF, sizeof(int) * n_rows * n_cols);
+	d->head = 0;
+	d->tail = 0;
+	if (!grid_get(goal % n_cols, goal / n_cols)){
+		d->dist[goal] = 0;
+		d->queue[d->tail++] = goal;
+	}
+	return d;
+}
+
+/**
+ * Distance from cell to the goal, in steps. The breadth
+ * first search goes on only until cell is reached.
+ */
+static int distance(GoalDistances *d, int cell){
+	int n_moves = horizontal_movement ? 9 : 5;
+	while (d->dist[cell] == UNKNOWN && d->head < d->tail){
+		int current = d->queue[d->head++];
+		int x = current % n_cols;
+		int y = current / n_cols;
+		for (int m = 1; m < n_moves; m++){
+			int nx = x + moves[m][0];
+			int ny = y + moves[m][1];
+			if (nx < 0 || nx >= n_cols || ny < 0 || ny >= n_rows || grid_get(nx, ny)){
+				continue;
+			}
+			int next = ny * n_cols + nx;
+			if (d->dist[next] == UNKNOWN){
+				d->dist[next] = d->dist[current] + 1;
+				d->queue[d->tail++] = next;
+			}
+		}
+	}
+	return d->dist[cell] == UNKNOWN ? UNREACHABLE : d->dist[cell];
+}
+
+static int reserved_by(int cell, int t){
+	uint64_t key = space_time(cell, t);
+	size_t mask = table_size - 1;
+	for (size_t i = hash(key) & mask; table[i].key; i = (i + 1) & mask){
+		if (table[i].key == key){
+			return table[i].agent;
+		}
+	}
+	return NO_AGENT;
+}
+
+static void touch(int cell){
+	if (cells[cell].parked == NO_AGENT && cells[cell].last_reserved < 0){
+		touched[n_touched++] = cell;
+	}
+}
+
+static int reserve(int cell, int t, int agent){
+	if ((table_used + 1) * 2 > table_size){
+		Reservation *old = table;
+		size_t old_size = table_size;
+		table_size *= 2;
+		table = calloc(table_size, sizeof(*table));
+		if (!table){
+			table = old;
+			table_size = old_size;
+			return -1;
+		}
+		for (size_t i = 0; i < old_size; i++){
+			if (old[i].key){
+				size_t j = hash(old[i].key) & (table_size - 1);
+				while (table[j].key){
+					j = (j + 1) & (table_size - 1);
+				}
+				table[j] = old[i];
+			}
+		}
+		free(old);
+	}
+	uint64_t key = space_time(cell, t);
+	size_t mask = table_size - 1;
+	size_t i = hash(key) & mask;
+	while (table[i].key && table[i].key != key){
+		i = (i + 1) & mask;
+	}
+	if (!table[i].key){
+		table_used++;
+	}
+	table[i] = (Reservation){key, agent};
+	touch(cell);
+	if (t > cells[cell].last_reserved){
+		cells[cell].last_reserved = t;
+	}
+	return 1;
+}
+
+static void park(int cell, int t, int agent){
+	touch(cell);
+	cells[cell].parked = agent;
+	cells[cell].parked_from = t;
+}
+
+static bool occupied(int cell, int t){
+	if (cells[cell].parked != NO_AGENT && cells[cell].parked_from <= t){
+		return true;
+	}
+	return reserved_by(cell, t) != NO_AGENT;
+}
+
+static Node* new_node(){
+	return arena_alloc(&pool, sizeof(Node));
+}
+
+static NodeSlot* find_slot(uint64_t key){
+	size_t mask = slots_size - 1;
+	size_t i = hash(key) & mask;
+	while (slots[i].stamp == stamp && slots[i].key != key){
+		i = (i + 1) & mask;
+	}
+	return &slots[i];
+}
+
+/**
+ * Makes room for one more node in the search: in the
+ * open list, and in the table of generated nodes.
+ */
+static int grow_search(){
+	if (open.n_elements == open_size){
+		Node **tmp = realloc(open.elements, sizeof(Node*) * open_size * 2);
+		if (!tmp){
+			return -1;
+		}
+		open.elements = tmp;
+		open_size *= 2;
+	}
+	if ((slots_used + 1) * 2 > slots_size){
+		NodeSlot *old = slots;
+		size_t old_size = slots_size;
+		slots_size *= 2;
+		slots = calloc(slots_size, sizeof(*slots));
+		if (!slots){
+			slots = old;
+			slots_size = old_size;
+			return -1;
+		}
+		for (size_t i = 0; i < old_size; i++){
+			if (old[i].stamp == stamp){
+				*find_slot(old[i].key) = old[i];
+			}
+		}
+		free(old);
+	}
+	return 1;
+}
+
+/**
+ * Space time A* of a single agent. Returns its last node, or NULL
+ * if it can't get to the goal (or to the end of the window).
+ */
+static Node* search_agent(Agent agent, int window, int n_agents){
+	int start = agent.start.y * n_cols + agent.start.x;
+	int goal = agent.goal.y * n_cols + agent.goal.x;
+	GoalDistances *d = goal_distances(goal);
+	if (!d){
+		return NULL;
+	}
+	int h = distance(d, start);
+	if (h == UNREACHABLE){
+		return NULL;
+	}
+	int limit = window > 0 ? window : h + TIME_SLACK + 2 * n_agents;
+	// The agent can't stop at the goal until it's no longer reserved, so
+	// it can't end before that either. Counting it in the heuristic makes
+	// the search go on in time instead of widening while it waits.
+	int free_at = cells[goal].last_reserved + 1;
+
+	arena_reset(&pool);
+	slots_used = 0;
+	stamp++;
+	open.n_elements = 0;
+	Node *node = new_node();
+	if (!node){
+		return NULL;
+	}
+	*node = (Node){.coord = agent.start, .g = 0, .h = h > free_at ? h : free_at, .heap_index = -1};
+	heap_add(&open, node);
+	*find_slot(space_time(start, 0)) = (NodeSlot){space_time(start, 0), stamp, node};
+	slots_used++;
+
+	int n_moves = horizontal_movement ? 9 : 5;
+	while (open.n_elements > 0){
+		node = heap_pop(&open);
+		int t = node->g;
+		int cell = node->coord.y * n_cols + node->coord.x;
+		// Nobody needs the goal later, so it can stay
+		if (cell == goal && cells[cell].last_reserved <= t){
+			return node;
+		}
+		if (window > 0 && t >= window){
+			return node;
+		}
+		if (t >= limit){
+			continue;
+		}
+		for (int m = 0; m < n_moves; m++){
+			int x = node->coord.x + moves[m][0];
+			int y = node->coord.y + moves[m][1];
+			if (x < 0 || x >= n_cols || y < 0 || y >= n_rows || grid_get(x, y)){
+				continue;
+			}
+			int next = y * n_cols + x;
+			if (occupied(next, t + 1)){
+				continue;
+			}
+			// Two agents can't swap their cells
+			if (m != 0){
+				int other = reserved_by(next, t);
+				if (other != NO_AGENT && reserved_by(cell, t + 1) == other){
+					continue;
+				}
+			}
+			uint64_t key = space_time(next, t + 1);
+			// Arriving later is never better, the first one is kept
+			if (find_slot(key)->stamp == stamp){
+				continue;
+			}
+			int next_h = distance(d, next);
+			if (next_h == UNREACHABLE || grow_search() != 1){
+				continue;
+			}
+			Node *child = new_node();
+			if (!child){
+				return NULL;
+			}
+			*child = (Node){
+				.parent = node,
+				.coord = {x, y},
+				.g = t + 1,
+				.h = next_h > free_at - t - 1 ? next_h : free_at - t - 1,
+				.heap_index = -1
+			};
+			*find_slot(key) = (NodeSlot){key, stamp, child};
+			slots_used++;
+			heap_add(&open, child);
+		}
+	}
+	return NULL;
+}
+
+static void reset_plan(){
+	for (int i = 0; i < n_touched; i++){
+		cells[touched[i]] = (CellState){NO_AGENT, 0, -1};
+	}
+	n_touched = 0;
+	memset(table, 0, sizeof(*table) * table_size);
+	table_used = 0;
+}
+
+static int init_plan(){
+	if (cells){
+		return 1;
+	}
+	long n_cells = (long)n_rows * n_cols;
+	cache_size = HEURISTIC_CACHE_BYTES / (2 * sizeof(int) * n_cells);
+	cache_size = cache_size < 1 ? 1 : cache_size > MAX_CACHED_GOALS ? MAX_CACHED_GOALS : cache_size;
+	cache = calloc(cache_size, sizeof(*cache));
+	cells = malloc(sizeof(*cells) * n_cells);
+	touched = malloc(sizeof(int) * n_cells);
+	table_size = MIN_TABLE_SIZE;
+	table = calloc(table_size, sizeof(*table));
+	slots_size = MIN_TABLE_SIZE;
+	slots = calloc(slots_size, sizeof(*slots));
+	open_size = MIN_TABLE_SIZE;
+	open.elements = malloc(sizeof(Node*) * open_size);
+	if (!cache || !cells || !touched || !table || !slots || !open.elements){
+		cooperative_free();
+		return -1;
+	}
+	for (int i = 0; i < cache_size; i++){
+		cache[i].goal = -1;
+	}
+	for (long i = 0; i < n_cells; i++){
+		cells[i] = (CellState){NO_AGENT, 0, -1};
+	}
+	return 1;
+}
+
+/**
+ * Plans the paths of n_agents agents, in order, so they don't collide:
+ * no two agents are in the same cell at the same time, nor swap cells.
+ * paths[i] is set to the path of agents[i], from its start to its goal,
+ * where path[t] is the cell at step t (waiting is a step too).
+ * With a window (WHCA*), only the first window steps are planned, and
+ * the plan is meant to be redone every few steps, so the paths end
+ * at the window unless they reach the goal before.
+ * An agent without a path stays at its start, and its path is only it.
+ * The agents planned before it may still go through that cell.
+ * Returns how many agents got a path, or -1 on error. The paths are
+ * only valid until the next call from this thread.
+ */
+int plan_cooperative(const Agent *agents, int n_agents, int window, Path *paths){
+	if (init_plan() != 1){
+		return -1;
+	}
+	reset_plan();
+	size_t *offsets = malloc(sizeof(size_t) * (n_agents + 1));
+	if (!offsets){
+		return -1;
+	}
+	size_t n_steps = 0;
+	int planned = 0;
+	for (int i = 0; i < n_agents; i++){
+		offsets[i] = n_steps;
+		Node *last = search_agent(agents[i], window, n_agents);
+		int length = last ? (int)last->g + 1 : 1;
+		if (n_steps + length > steps_size){
+			size_t size = steps_size ? steps_size : 1024;
+			while (size < n_steps + length){
+				size *= 2;
+			}
+			Coordinates *tmp = realloc(steps, sizeof(Coordinates) * size);
+			if (!tmp){
+				free(offsets);
+				return -1;
+			}
+			steps = tmp;
+			steps_size = size;
+		}
+		Coordinates *path = &steps[n_steps];
+		if (last){
+			for (Node *n = last; n; n = n->parent){
+				path[(int)n->g] = n->coord;
+			}
+			planned++;
+		}else{
+			path[0] = agents[i].start;
+		}
+		for (int t = 0; t < length; t++){
+			if (reserve(path[t].y * n_cols + path[t].x, t, i) != 1){
+				free(offsets);
+				return -1;
+			}
+		}
+		Coordinates end = path[length - 1];
+		if (!last || (end.x == agents[i].goal.x && end.y == agents[i].goal.y)){
+			park(end.y * n_cols + end.x, length - 1, i);
+		}
+		paths[i].path_length = length;
+		paths[i].bound = 1.0;
+		n_steps += length;
+	}
+	for (int i = 0; i < n_agents; i++){
+		paths[i].path = &steps[offsets[i]];
+	}
+	free(offsets);
+	return planned;
+}
+
+void cooperative_free(void){
+	for (int i = 0; cache && i < cache_size; i++){
+		free(cache[i].dist);
+		free(cache[i].queue);
+	}
+	free(cache);
+	free(cells);
+	free(touched);
+	free(table);
+	free(slots);
+	free(open.elements);
+	arena_free(&pool);
+	free(steps);
+	cache = NULL;
+	cells = NULL;
+	touched = NULL;
+	table = NULL;
+	slots = NULL;
+	open.elements = NULL;
+	steps = NULL;
+	steps_size = 0;
+	n_touched = 0;
+	table_used = 0;
+}
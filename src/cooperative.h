@@ -0,0 +1,18 @@
+/**
+ * Cooperative path finding of several agents (HCA* / WHCA*).
+ */
+#ifndef COOPERATIVE_H
+#define COOPERATIVE_H
+
+#include "path_finding.h"
+
+typedef struct Agent {
+	Coordinates start;
+	Coordinates goal;
+} Agent;
+
+int plan_cooperative(const Agent *agents, int n_agents, int window, Path *paths);
+
+void cooperative_free(void);
+
+#endif // COOPERATIVE_H
@@ -0,0 +1,75 @@
+/**
+ * Traversal cost of the cells of the grid.
+ * A count of the cells of each cost is kept along with the map, so
+ * the lowest cost, which scales the heuristics, and whether every
+ * cell costs the same, which lets the searches skip the costs, are
+ * known without going through the grid. They are stored in the
+ * version of the grid, so each search reads the ones of its own.
+ */
+#include "cost.h"
+#include "grid.h"
+#include <string.h>
+
+extern int n_rows;
+extern int n_cols;
+
+// Of the working version of the grid
+static long count[COST_MAX + 1];
+
+static inline int clamp(int value){
+	return value < COST_MIN ? COST_MIN : value > COST_MAX ? COST_MAX : value;
+}
+
+static void update_summary(void){
+	int low = COST_MIN;
+	while (low < COST_MAX && count[low] == 0){
+		low++;
+	}
+	grid_working->cost_lowest = low;
+	grid_working->cost_uniform = count[low] == (long)n_rows * n_cols;
+	grid_working->changed = true;
+}
+
+/**
+ * Sets every cell to COST_DEFAULT, unless the map came attached to
+ * the grid, from a snapshot. Then its values are counted, and the
+ * ones below COST_MIN raised to it.
+ */
+int cost_init(void){
+	if (!grid_attached(GRID_COSTS)){
+		cost_fill(COST_DEFAULT);
+		return 1;
+	}
+	memset(count, 0, sizeof(count));
+	for (int y = 0; y < n_rows; y++){
+		const uint8_t *row = grid_layer_row(GRID_COSTS, y);
+		for (int x = 0; x < n_cols; x++){
+			if (row[x] < COST_MIN){
+				grid_layer_row_mut(GRID_COSTS, y)[x] = COST_MIN;
+			}
+			count[row[x]]++;
+		}
+	}
+	update_summary();
+	return 1;
+}
+
+void cost_set(int x, int y, int value){
+	value = clamp(value);
+	if (cost_get(x, y) == value){
+		return;
+	}
+	uint8_t *cell = &grid_layer_row_mut(GRID_COSTS, y)[x];
+	count[*cell]--;
+	count[value]++;
+	*cell = value;
+	update_summary();
+}
+
+void cost_fill(int value){
+	value = clamp(value);
+	grid_layer_fill(GRID_COSTS, value);
+	memset(count, 0, sizeof(count));
+	count[value] = (long)n_rows * n_cols;
+	update_summary();
+}
@@ -0,0 +1,44 @@
+/**
+ * Traversal cost of the cells of the grid.
+ * One byte per cell, from COST_MIN to COST_MAX: a move between two
+ * cells costs its length times the mean of their costs. Every cell
+ * starts at COST_DEFAULT, so a grid nobody has painted costs the
+ * same as one without costs.
+ */
+#ifndef COST_H
+#define COST_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "grid.h"
+
+#define COST_MIN 1
+#define COST_MAX 255
+#define COST_DEFAULT 1
+
+static inline int cost_get(int x, int y){
+	return grid_view->rows[GRID_COSTS][y >> GRID_BAND_BITS][(long)(y & GRID_BAND_MASK) * n_cols + x];
+}
+
+/**
+ * Lowest cost of any cell. A move costs at least its length times
+ * it, so scaling an admissible heuristic by it keeps it admissible.
+ */
+static inline int cost_lowest(void){
+	return grid_view->cost_lowest;
+}
+
+/**
+ * Whether every cell costs the same. Then the costs only scale
+ * every path by the same amount, and can be ignored.
+ */
+static inline bool cost_uniform(void){
+	return grid_view->cost_uniform;
+}
+
+int cost_init(void);
+
+void cost_set(int x, int y, int value);
+void cost_fill(int value);
+
+#endif // COST_H
@@ -0,0 +1,659 @@
+/**
+ * Compressed path database.
+ * It's built with a Dijkstra search from every free cell, which finds
+ * the set of optimal first moves towards every other cell. The targets
+ * are then run length encoded in row major order, greedily extending
+ * every run while some move is optimal for all of its targets. The
+ * barriers, the cells of other connected components and the source
+ * itself can take any move, so they never break a run.
+ *
+ * Layout of the database, a single block so it can be saved to (and
+ * used in place from) a snapshot:
+ *   CpdHeader
+ *   int32_t components[n_rows * n_cols], padded to 8 bytes
+ *   uint64_t offsets[n_rows * n_cols + 1], into runs, per source
+ *   uint32_t runs[n_runs], (first target << 3) | move
+ */
+#include "cpd.h"
+#include "grid.h"
+#include "cost.h"
+#include "trace.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+#include <math.h>
+
+extern int n_rows;
+extern int n_cols;
+extern bool horizontal_movement;
+
+#define MOVE_BITS 3
+#define MAX_CELLS (1L << (32 - MOVE_BITS))
+#define MAX_THREADS 256
+// Sources taken at once by a build thread
+#define SOURCE_CHUNK 64
+#define EPSILON 1e-7
+
+typedef struct CpdHeader {
+	uint32_t n_moves;  // 4 or 8, the movement it was built for
+	uint32_t reserved;
+	uint64_t n_runs;
+} CpdHeader;
+
+typedef struct HeapEntry {
+	double dist;
+	int cell;
+} HeapEntry;
+
+// Scratch space and output of a build thread
+typedef struct Builder {
+	int id;
+	double *dist;
+	uint8_t *mask;  // Optimal first moves, one bit each
+	int *order;     // Cells in the order they were settled
+	HeapEntry *heap;
+	size_t heap_len;
+	size_t heap_cap;
+	uint32_t *runs;
+	size_t n_runs;
+	size_t runs_cap;
+	pthread_t thread;
+} Builder;
+
+static const int moves[8][2] = {
+	{-1, 0}, {1, 0}, {0, 1}, {0, -1},
+	{-1, 1}, {-1, -1}, {1, 1}, {1, -1}
+};
+static const int opposite[8] = {1, 0, 3, 2, 7, 6, 5, 4};
+
+static unsigned char *data;
+static uint64_t data_size;
+// Set when data is not owned, like a mapped snapshot
+static bool attached = false;
+static unsigned long version;
+static CpdStats stats;
+
+static const CpdHeader *header;
+static const int32_t *components;
+static const uint64_t *offsets;
+static const uint32_t *runs;
+
+static struct {
+	int32_t *components;
+	int n_moves;
+	atomic_long next;
+	atomic_int failed;
+	int *thread_of;      // Builder with the runs of each source
+	uint64_t *start_of;  // And where they start in it
+	uint32_t *count_of;
+	GridVersion *view;   // Of the calling thread, which the builders read too
+} build;
+
+static _Thread_local Path path;
+static _Thread_local int path_capacity;
+
+static inline uint64_t align8(uint64_t n){
+	return (n + 7) & ~(uint64_t)7;
+}
+
+static uint64_t components_offset(void){
+	return align8(sizeof(CpdHeader));
+}
+
+static uint64_t offsets_offset(void){
+	return components_offset() + align8(sizeof(int32_t) * (uint64_t)n_rows * n_cols);
+}
+
+static uint64_t runs_offset(void){
+	return offsets_offset() + sizeof(uint64_t) * ((uint64_t)n_rows * n_cols + 1);
+}
+
+static void set_pointers(void){
+	header = (const CpdHeader*)data;
+	components = (const int32_t*)(data + components_offset());
+	offsets = (const uint64_t*)(data + offsets_offset());
+	runs = (const uint32_t*)(data + runs_offset());
+}
+
+static inline double move_cost(int m){
+	return m < 4 ? 1.0 : M_SQRT2;
+}
+
+/**
+ * Labels the connected components of the free cells,
+ * with -1 for the barriers.
+ */
+static int label_components(int32_t *labels){
+	long n_cells = (long)n_rows * n_cols;
+	int *queue = malloc(sizeof(int) * n_cells);
+	if (!queue){
+		return -1;
+	}
+	for (long i = 0; i < n_cells; i++){
+		labels[i] = -1;
+	}
+	int32_t n_components = 0;
+	for (long i = 0; i < n_cells; i++){
+		if (labels[i] >= 0 || grid_get(i % n_cols, i / n_cols)){
+			continue;
+		}
+		int head = 0, tail = 0;
+		labels[i] = n_components;
+		queue[tail++] = i;
+		while (head < tail){
+			int cell = queue[head++];
+			for (int m = 0; m < build.n_moves; m++){
+				int x = cell % n_cols + moves[m][0];
+				int y = cell / n_cols + moves[m][1];
+				if (x < 0 || x >= n_cols || y < 0 || y >= n_rows || grid_get(x, y)){
+					continue;
+				}
+				int next = y * n_cols + x;
+				if (labels[next] < 0){
+					labels[next] = n_components;
+					queue[tail++] = next;
+				}
+			}
+		}
+		n_components++;
+	}
+	free(queue);
+	return 1;
+}
+
+static int heap_push(Builder *b, double dist, int cell){
+	if (b->heap_len == b->heap_cap){
+		size_t cap = b->heap_cap ? b->heap_cap * 2 : 1024;
+		HeapEntry *tmp = realloc(b->heap, sizeof(HeapEntry) * cap);
+		if (!tmp){
+			return -1;
+		}
+		b->heap = tmp;
+		b->heap_cap = cap;
+	}
+	size_t i = b->heap_len++;
+	while (i > 0 && b->heap[(i - 1) / 2].dist > dist){
+		b->heap[i] = b->heap[(i - 1) / 2];
+		i = (i - 1) / 2;
+	}
+	b->heap[i] = (HeapEntry){dist, cell};
+	return 1;
+}
+
+static HeapEntry heap_pop_min(Builder *b){
+	HeapEntry top = b->heap[0];
+	HeapEntry last = b->heap[--b->heap_len];
+	size_t i = 0;
+	for (;;){
+		size_t child = i * 2 + 1;
+		if (child >= b->heap_len){
+			break;
+		}
+		if (child + 1 < b->heap_len && b->heap[child + 1].dist < b->heap[child].dist){
+			child++;
+		}
+		if (b->heap[child].dist >= last.dist){
+			break;
+		}
+		b->heap[i] = b->heap[child];
+		i = child;
+	}
+	if (b->heap_len > 0){
+		b->heap[i] = last;
+	}
+	return top;
+}
+
+static int emit_run(Builder *b, int first, uint8_t candidates){
+	if (b->n_runs == b->runs_cap){
+		size_t cap = b->runs_cap ? b->runs_cap * 2 : 4096;
+		uint32_t *tmp = realloc(b->runs, sizeof(uint32_t) * cap);
+		if (!tmp){
+			return -1;
+		}
+		b->runs = tmp;
+		b->runs_cap = cap;
+	}
+	int move = candidates ? __builtin_ctz(candidates) : 0;
+	b->runs[b->n_runs++] = (uint32_t)first << MOVE_BITS | move;
+	return 1;
+}
+
+/**
+ * Dijkstra from source, then the first moves of every
+ * target it reached, compressed into the builder's runs.
+ */
+static int build_source(Builder *b, int source){
+	int n_settled = 0;
+	b->heap_len = 0;
+	b->dist[source] = 0;
+	if (heap_push(b, 0, source) != 1){
+		return -1;
+	}
+	while (b->heap_len > 0){
+		HeapEntry e = heap_pop_min(b);
+		if (e.dist > b->dist[e.cell]){
+			continue;
+		}
+		b->order[n_settled++] = e.cell;
+		int x = e.cell % n_cols;
+		int y = e.cell / n_cols;
+		for (int m = 0; m < build.n_moves; m++){
+			int nx = x + moves[m][0];
+			int ny = y + moves[m][1];
+			if (nx < 0 || nx >= n_cols || ny < 0 || ny >= n_rows || grid_get(nx, ny)){
+				continue;
+			}
+			int next = ny * n_cols + nx;
+			double dist = e.dist + move_cost(m);
+			if (dist < b->dist[next]){
+				b->dist[next] = dist;
+				if (heap_push(b, dist, next) != 1){
+					return -1;
+				}
+			}
+		}
+	}
+
+	// The first moves of a cell are those of the neighbours it can be
+	// optimally reached from, which were settled before it
+	b->mask[source] = 0;
+	for (int i = 1; i < n_settled; i++){
+		int cell = b->order[i];
+		int x = cell % n_cols;
+		int y = cell / n_cols;
+		uint8_t mask = 0;
+		for (int m = 0; m < build.n_moves; m++){
+			int nx = x + moves[m][0];
+			int ny = y + moves[m][1];
+			if (nx < 0 || nx >= n_cols || ny < 0 || ny >= n_rows){
+				continue;
+			}
+			int prev = ny * n_cols + nx;
+			if (fabs(b->dist[prev] + move_cost(m) - b->dist[cell]) > EPSILON){
+				continue;
+			}
+			mask |= prev == source ? 1 << opposite[m] : b->mask[prev];
+		}
+		b->mask[cell] = mask;
+	}
+
+	int32_t component = build.components[source];
+	long n_cells = (long)n_rows * n_cols;
+	uint8_t candidates = 0xFF;
+	int first = 0;
+	for (long target = 0; target < n_cells; target++){
+		if (target == source || build.components[target] != component){
+			continue;
+		}
+		if (candidates & b->mask[target]){
+			candidates &= b->mask[target];
+		}else{
+			if (emit_run(b, first, candidates) != 1){
+				return -1;
+			}
+			first = target;
+			candidates = b->mask[target];
+		}
+	}
+	if (candidates != 0xFF && emit_run(b, first, candidates) != 1){
+		return -1;
+	}
+	for (int i = 0; i < n_settled; i++){
+		b->dist[b->order[i]] = INFINITY;
+	}
+	return 1;
+}
+
+static void* build_thread(void *arg){
+	Builder *b = arg;
+	grid_view = build.view;
+	// The first one runs on the calling thread
+	if (b->id > 0){
+		trace_thread_name("cpd builder");
+	}
+	long n_cells = (long)n_rows * n_cols;
+	while (!atomic_load(&build.failed)){
+		long first = atomic_fetch_add(&build.next, SOURCE_CHUNK);
+		if (first >= n_cells){
+			break;
+		}
+		long last = first + SOURCE_CHUNK < n_cells ? first + SOURCE_CHUNK : n_cells;
+		trace_begin("cpd_sources");
+		for (long source = first; source < last; source++){
+			build.thread_of[source] = b->id;
+			build.start_of[source] = b->n_runs;
+			if (build.components[source] >= 0 && build_source(b, source) != 1){
+				atomic_store(&build.failed, 1);
+				break;
+			}
+			build.count_of[source] = b->n_runs - build.start_of[source];
+		}
+		trace_end();
+	}
+	return NULL;
+}
+
+static double now_seconds(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void free_builders(Builder *builders, int n_threads){
+	for (int t = 0; builders && t < n_threads; t++){
+		free(builders[t].dist);
+		free(builders[t].mask);
+		free(builders[t].order);
+		free(builders[t].heap);
+		free(builders[t].runs);
+	}
+	free(builders);
+	free(build.components);
+	free(build.thread_of);
+	free(build.start_of);
+	free(build.count_of);
+	build.components = NULL;
+	build.thread_of = NULL;
+	build.start_of = NULL;
+	build.count_of = NULL;
+}
+
+/**
+ * Builds the database of the current grid with n_threads threads,
+ * each one taking the next chunk of sources. It takes a search over
+ * the whole grid per free cell, so it's only meant for small and
+ * medium grids, built offline and saved to a snapshot.
+ */
+int cpd_build(int n_threads){
+	long n_cells = (long)n_rows * n_cols;
+	if (n_cells > MAX_CELLS){
+		return -1;
+	}
+	if (n_threads < 1){
+		n_threads = 1;
+	}else if (n_threads > MAX_THREADS){
+		n_threads = MAX_THREADS;
+	}
+	double start = now_seconds();
+	build.n_moves = horizontal_movement ? 8 : 4;
+	build.components = malloc(sizeof(int32_t) * n_cells);
+	build.thread_of = malloc(sizeof(int) * n_cells);
+	build.start_of = malloc(sizeof(uint64_t) * n_cells);
+	build.count_of = malloc(sizeof(uint32_t) * n_cells);
+	Builder *builders = calloc(n_threads, sizeof(Builder));
+	if (!build.components || !build.thread_of || !build.start_of || !build.count_of || !builders
+	    || label_components(build.components) != 1){
+		free_builders(builders, n_threads);
+		return -1;
+	}
+	for (int t = 0; t < n_threads; t++){
+		Builder *b = &builders[t];
+		b->id = t;
+		b->dist = malloc(sizeof(double) * n_cells);
+		b->mask = malloc(n_cells);
+		b->order = malloc(sizeof(int) * n_cells);
+		if (!b->dist || !b->mask || !b->order){
+			free_builders(builders, n_threads);
+			return -1;
+		}
+		for (long i = 0; i < n_cells; i++){
+			b->dist[i] = INFINITY;
+		}
+	}
+
+	build.view = grid_view;
+	atomic_store(&build.next, 0);
+	atomic_store(&build.failed, 0);
+	// The calling thread builds too, and alone if no thread can be started
+	int started = 1;
+	for (; started < n_threads; started++){
+		if (pthread_create(&builders[started].thread, NULL, build_thread, &builders[started]) != 0){
+			break;
+		}
+	}
+	build_thread(&builders[0]);
+	for (int t = 1; t < started; t++){
+		pthread_join(builders[t].thread, NULL);
+	}
+	if (atomic_load(&build.failed)){
+		free_builders(builders, n_threads);
+		return -1;
+	}
+
+	uint64_t n_runs = 0;
+	for (int t = 0; t < n_threads; t++){
+		n_runs += builders[t].n_runs;
+	}
+	uint64_t size = runs_offset() + sizeof(uint32_t) * n_runs;
+	unsigned char *block = calloc(size, 1);
+	if (!block){
+		free_builders(builders, n_threads);
+		return -1;
+	}
+	cpd_free();
+	data = block;
+	data_size = size;
+	*(CpdHeader*)data = (CpdHeader){.n_moves = build.n_moves, .n_runs = n_runs};
+	set_pointers();
+	memcpy((int32_t*)components, build.components, sizeof(int32_t) * n_cells);
+	uint64_t *offs = (uint64_t*)offsets;
+	uint32_t *out = (uint32_t*)runs;
+	uint64_t n = 0;
+	stats.n_sources = 0;
+	for (long source = 0; source < n_cells; source++){
+		offs[source] = n;
+		if (components[source] < 0){
+			continue;
+		}
+		Builder *b = &builders[build.thread_of[source]];
+		memcpy(out + n, b->runs + build.start_of[source], sizeof(uint32_t) * build.count_of[source]);
+		n += build.count_of[source];
+		stats.n_sources++;
+	}
+	offs[n_cells] = n;
+	free_builders(builders, n_threads);
+
+	version = grid_version();
+	stats.n_runs = n_runs;
+	stats.bytes = size;
+	stats.build_seconds = now_seconds() - start;
+	return 1;
+}
+
+/**
+ * Uses the database in data, as saved by a snapshot, without copying it.
+ * It's only taken as up to date for the grid as it is now.
+ * Only its header and size are checked, so it's not read until it's
+ * used: the queries check the runs they follow, and cpd_verify all.
+ */
+int cpd_attach(const void *block, uint64_t size){
+	uint64_t n_cells = (uint64_t)n_rows * n_cols;
+	if (!block || size < runs_offset()){
+		return -1;
+	}
+	const CpdHeader *h = block;
+	const uint64_t *offs = (const uint64_t*)((const unsigned char*)block + offsets_offset());
+	if ((h->n_moves != 4 && h->n_moves != 8)
+	    || (size - runs_offset()) % sizeof(uint32_t) != 0
+	    || (size - runs_offset()) / sizeof(uint32_t) != h->n_runs
+	    || offs[n_cells] != h->n_runs){
+		return -1;
+	}
+	cpd_free();
+	data = (unsigned char*)block;
+	data_size = size;
+	attached = true;
+	set_pointers();
+	version = grid_version();
+	// The sources are counted if they're asked for
+	stats = (CpdStats){.n_sources = -1, .n_runs = h->n_runs, .bytes = size};
+	return 1;
+}
+
+/**
+ * Checks the whole database: the runs of every source must be within
+ * it, and their moves of its movement. A source alone in its component
+ * has none. Reads all of it, unlike the queries, which only check the
+ * runs they follow. Returns -1 if it's corrupt.
+ */
+int cpd_verify(void){
+	if (!data){
+		return -1;
+	}
+	uint64_t n_cells = (uint64_t)n_rows * n_cols;
+	for (uint64_t i = 0; i < n_cells; i++){
+		if (offsets[i] > offsets[i + 1]){
+			return -1;
+		}
+	}
+	for (uint64_t i = offsets[0]; i < header->n_runs; i++){
+		if ((runs[i] & ((1 << MOVE_BITS) - 1)) >= header->n_moves){
+			return -1;
+		}
+	}
+	return 1;
+}
+
+void cpd_free(void){
+	if (!attached){
+		free(data);
+	}
+	data = NULL;
+	data_size = 0;
+	attached = false;
+	header = NULL;
+}
+
+void cpd_thread_free(void){
+	free(path.path);
+	path.path = NULL;
+	path_capacity = 0;
+}
+
+/**
+ * Grows the path of the thread to hold n cells, doubling it.
+ */
+static bool reserve_path(int n){
+	if (n <= path_capacity){
+		return true;
+	}
+	int capacity = path_capacity ? path_capacity * 2 : 256;
+	while (capacity < n){
+		capacity *= 2;
+	}
+	Coordinates *grown = realloc(path.path, sizeof(Coordinates) * capacity);
+	if (!grown){
+		return false;
+	}
+	path.path = grown;
+	path_capacity = capacity;
+	return true;
+}
+
+/**
+ * Whether there's a database, built for the current
+ * movement, and the grid hasn't changed since. Its paths
+ * ignore the costs, so they must all be the same.
+ */
+bool cpd_ready(void){
+	return data && version == grid_version() && cost_uniform()
+	       && header->n_moves == (horizontal_movement ? 8u : 4u);
+}
+
+/**
+ * Returns the database as a single block, to be saved.
+ */
+const void* cpd_data(uint64_t *size){
+	if (size){
+		*size = data_size;
+	}
+	return data;
+}
+
+CpdStats cpd_stats(void){
+	if (data && stats.n_sources < 0){
+		stats.n_sources = 0;
+		for (long i = 0; i < (long)n_rows * n_cols; i++){
+			stats.n_sources += components[i] >= 0;
+		}
+	}
+	return stats;
+}
+
+/**
+ * First move of an optimal path from one cell to another:
+ * the one of the last run of from that starts before to.
+ */
+static inline int first_move(int from, int to){
+	const uint32_t *r = &runs[offsets[from]];
+	uint64_t lo = 0;
+	uint64_t hi = offsets[from + 1] - offsets[from];
+	uint32_t key = (uint32_t)to << MOVE_BITS | ((1 << MOVE_BITS) - 1);
+	while (hi - lo > 1){
+		uint64_t mid = (lo + hi) / 2;
+		if (r[mid] <= key){
+			lo = mid;
+		}else{
+			hi = mid;
+		}
+	}
+	return r[lo] & ((1 << MOVE_BITS) - 1);
+}
+
+/**
+ * Optimal path from start to end (for an agent of size 1), following
+ * the first moves of the database: no search, no heap, and a binary
+ * search over the runs of a cell per step. Like find_path's, the path
+ * goes from start to end, and only holds end if there's none. The
+ * turns are not penalized, so it may be another path of the same cost.
+ * Falls back to find_path if the database is not ready.
+ * The Path is only valid until the next call from this thread.
+ */
+Path find_path_cpd(Coordinates start, Coordinates end){
+	if (!cpd_ready()){
+		return find_path(start, end, NULL, 1);
+	}
+	long n_cells = (long)n_rows * n_cols;
+	if (!reserve_path(1)){
+		return find_path(start, end, NULL, 1);
+	}
+	path.bound = 1.0;
+	path.path_length = 0;
+	int from = start.y * n_cols + start.x;
+	int to = end.y * n_cols + end.x;
+	if (components[from] < 0 || components[from] != components[to]){
+		path.path[path.path_length++] = end;
+		return path;
+	}
+	Coordinates c = start;
+	path.path[path.path_length++] = c;
+	while (from != to && path.path_length < n_cells){
+		if (!reserve_path(path.path_length + 1)){
+			return find_path(start, end, NULL, 1);
+		}
+		// Only a corrupt database, which is not checked when attached,
+		// has runs out of it, other moves or leaves the component
+		if (offsets[from] >= offsets[from + 1] || offsets[from + 1] > header->n_runs){
+			return find_path(start, end, NULL, 1);
+		}
+		int move = first_move(from, to);
+		if ((unsigned)move >= header->n_moves){
+			return find_path(start, end, NULL, 1);
+		}
+		c.x += moves[move][0];
+		c.y += moves[move][1];
+		if (c.x < 0 || c.x >= n_cols || c.y < 0 || c.y >= n_rows
+		    || components[c.y * n_cols + c.x] != components[to]){
+			return find_path(start, end, NULL, 1);
+		}
+		from = c.y * n_cols + c.x;
+		path.path[path.path_length++] = c;
+	}
+	if (from != to){
+		return find_path(start, end, NULL, 1);
+	}
+	return path;
+}
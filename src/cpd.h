@@ -0,0 +1,33 @@
+/**
+ * Compressed path database (CPD).
+ * For every cell, the first move of an optimal path towards every
+ * other cell, so a path is found by following first moves, without
+ * searching. Meant for grids that rarely change: the database is
+ * stale after any edit, and find_path_cpd falls back to find_path.
+ */
+#ifndef CPD_H
+#define CPD_H
+
+#include "path_finding.h"
+#include <stdint.h>
+
+typedef struct CpdStats {
+	long n_sources;
+	uint64_t n_runs;
+	uint64_t bytes;
+	double build_seconds;
+} CpdStats;
+
+int cpd_build(int n_threads);
+int cpd_attach(const void *data, uint64_t size);
+int cpd_verify(void);
+void cpd_free(void);
+void cpd_thread_free(void);
+
+bool cpd_ready(void);
+const void* cpd_data(uint64_t *size);
+CpdStats cpd_stats(void);
+
+Path find_path_cpd(Coordinates start, Coordinates end);
+
+#endif // CPD_H
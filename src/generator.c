@@ -0,0 +1,527 @@
+/**
+ * Seeded map and scenario generator.
+ */
+#include "generator.h"
+#include "grid.h"
+#include "clearance.h"
+#include "subgoal.h"
+#include "path_finding.h"
+#include "trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+
+extern int n_rows;
+extern int n_cols;
+
+// 0 means that the seed is taken from the clock
+uint64_t generator_seed = 0;
+int generator_threads = 1;
+
+#define CAVE_ITERATIONS 4
+
+static uint64_t splitmix64(uint64_t *state){
+	uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	return z ^ (z >> 31);
+}
+
+void rng_seed(Rng *rng, uint64_t seed){
+	for (int i = 0; i < 4; i++){
+		rng->s[i] = splitmix64(&seed);
+	}
+}
+
+static inline uint64_t rotl(uint64_t x, int k){
+	return (x << k) | (x >> (64 - k));
+}
+
+uint64_t rng_next(Rng *rng){
+	uint64_t *s = rng->s;
+	uint64_t result = rotl(s[1] * 5, 7) * 9;
+	uint64_t t = s[1] << 17;
+	s[2] ^= s[0];
+	s[3] ^= s[1];
+	s[1] ^= s[2];
+	s[0] ^= s[3];
+	s[2] ^= t;
+	s[3] = rotl(s[3], 45);
+	return result;
+}
+
+/**
+ * Returns a number in [0, n).
+ */
+uint32_t rng_range(Rng *rng, uint32_t n){
+	return (uint32_t)(((rng_next(rng) >> 32) * n) >> 32);
+}
+
+uint64_t generator_next_seed(void){
+	if (generator_seed == 0){
+		generator_seed = time(NULL);
+	}
+	return splitmix64(&generator_seed);
+}
+
+int generator_parse_family(const char *name, generator_family *family){
+	if (strcmp(name, "random") == 0){
+		*family = GEN_UNIFORM;
+	}else if (strcmp(name, "rooms") == 0){
+		*family = GEN_ROOMS;
+	}else if (strcmp(name, "maze") == 0){
+		*family = GEN_MAZE;
+	}else if (strcmp(name, "caves") == 0){
+		*family = GEN_CAVES;
+	}else{
+		return -1;
+	}
+	return 1;
+}
+
+/**
+ * Each row has its own random stream, derived from the seed and
+ * the row number. That's what makes the result independent of
+ * how the rows are split between threads.
+ */
+static void row_rng(Rng *rng, uint64_t seed, int row){
+	rng_seed(rng, seed + (uint64_t)row * 0xD1B54A32D192ED03ULL);
+}
+
+/**
+ * Returns a word where every bit is set with a
+ * probability of threshold / 256.
+ * Each random word halves the probability and the bits of the
+ * threshold, from the lowest one, decide whether to add 1/2.
+ */
+static inline uint64_t bernoulli_word(Rng *rng, uint32_t threshold){
+	if (threshold >= 256){
+		return ~(uint64_t)0;
+	}
+	uint64_t mask = 0;
+	for (int b = 0; b < 8; b++){
+		uint64_t r = rng_next(rng);
+		mask = ((threshold >> b) & 1) ? (mask | r) : (mask & r);
+	}
+	return mask;
+}
+
+static void uniform_rows(uint64_t seed, int density, uint64_t *dst, int first, int last){
+	uint32_t threshold = density * 256 / 100;
+	uint64_t tail = grid_tail_mask();
+	for (int i = first; i < last; i++){
+		Rng rng;
+		row_rng(&rng, seed, i);
+		uint64_t *row = &dst[(long)i * grid_row_words];
+		for (int w = 0; w < grid_row_words; w++){
+			row[w] = bernoulli_word(&rng, threshold);
+		}
+		row[grid_row_words - 1] &= tail;
+	}
+}
+
+/**
+ * Adds a one bit input x to the bit sliced counter s.
+ */
+static inline void count_bit(uint64_t s[4], uint64_t x){
+	uint64_t c0 = s[0] & x;
+	s[0] ^= x;
+	uint64_t c1 = s[1] & c0;
+	s[1] ^= c0;
+	uint64_t c2 = s[2] & c1;
+	s[2] ^= c1;
+	s[3] |= c2;
+}
+
+/**
+ * Word of src at (row, w). Cells outside of the grid are barriers.
+ */
+static inline uint64_t cave_word(const uint64_t *src, int row, int w){
+	if (row < 0 || row >= n_rows || w < 0 || w >= grid_row_words){
+		return ~(uint64_t)0;
+	}
+	uint64_t word = src[(long)row * grid_row_words + w];
+	if (w == grid_row_words - 1){
+		word |= ~grid_tail_mask();
+	}
+	return word;
+}
+
+/**
+ * One step of the cave automata, for 64 cells at a time.
+ * A cell becomes a barrier if at least 5 of its neighbours
+ * are barriers, and stays one if at least 4 are.
+ */
+static void cave_rows(const uint64_t *src, uint64_t *dst, int first, int last){
+	uint64_t tail = grid_tail_mask();
+	for (int i = first; i < last; i++){
+		for (int w = 0; w < grid_row_words; w++){
+			uint64_t s[4] = {0};
+			for (int dy = -1; dy <= 1; dy++){
+				uint64_t prev = cave_word(src, i + dy, w - 1);
+				uint64_t cur = cave_word(src, i + dy, w);
+				uint64_t next = cave_word(src, i + dy, w + 1);
+				count_bit(s, (cur << 1) | (prev >> 63));
+				count_bit(s, (cur >> 1) | (next << 63));
+				if (dy != 0){
+					count_bit(s, cur);
+				}
+			}
+			uint64_t at_least_4 = s[2] | s[3];
+			uint64_t at_least_5 = s[3] | (s[2] & (s[1] | s[0]));
+			uint64_t cell = src[(long)i * grid_row_words + w];
+			dst[(long)i * grid_row_words + w] = at_least_5 | (cell & at_least_4);
+		}
+		dst[(long)i * grid_row_words + grid_row_words - 1] &= tail;
+	}
+}
+
+typedef struct Band {
+	generator_family family;
+	uint64_t seed;
+	int density;
+	const uint64_t *src;
+	uint64_t *dst;
+	int first;
+	int last;
+} Band;
+
+static void* band_worker(void *arg){
+	Band *band = arg;
+	trace_begin("generate_band");
+	if (band->family == GEN_UNIFORM){
+		uniform_rows(band->seed, band->density, band->dst, band->first, band->last);
+	}else{
+		cave_rows(band->src, band->dst, band->first, band->last);
+	}
+	trace_end();
+	return NULL;
+}
+
+/**
+ * Splits the rows of the grid in n_threads bands and runs
+ * the job of band on each one.
+ */
+static void run_bands(Band band, int n_threads){
+	if (n_threads > n_rows){
+		n_threads = n_rows;
+	}
+	if (n_threads <= 1){
+		band.first = 0;
+		band.last = n_rows;
+		band_worker(&band);
+		return;
+	}
+	pthread_t threads[n_threads];
+	bool started[n_threads];
+	Band bands[n_threads];
+	for (int t = 0; t < n_threads; t++){
+		bands[t] = band;
+		bands[t].first = (long)n_rows * t / n_threads;
+		bands[t].last = (long)n_rows * (t + 1) / n_threads;
+		started[t] = pthread_create(&threads[t], NULL, band_worker, &bands[t]) == 0;
+		if (!started[t]){
+			band_worker(&bands[t]);
+		}
+	}
+	for (int t = 0; t < n_threads; t++){
+		if (started[t]){
+			pthread_join(threads[t], NULL);
+		}
+	}
+}
+
+/**
+ * The bands work on a copy of the barriers, which
+ * replaces the ones of the grid when they are done.
+ */
+static int generate_uniform(uint64_t seed, int density, int n_threads){
+	uint64_t *bits = malloc((size_t)n_rows * grid_row_size[GRID_BARRIERS]);
+	if (!bits){
+		return -1;
+	}
+	run_bands((Band){.family = GEN_UNIFORM, .seed = seed, .density = density, .dst = bits}, n_threads);
+	grid_layer_write(GRID_BARRIERS, bits);
+	free(bits);
+	return 1;
+}
+
+static int generate_caves(uint64_t seed, int density, int n_threads){
+	size_t size = (size_t)n_rows * grid_row_size[GRID_BARRIERS];
+	uint64_t *src = malloc(size);
+	uint64_t *dst = malloc(size);
+	if (!src || !dst){
+		free(src);
+		free(dst);
+		return -1;
+	}
+	run_bands((Band){.family = GEN_UNIFORM, .seed = seed, .density = density, .dst = src}, n_threads);
+	for (int it = 0; it < CAVE_ITERATIONS; it++){
+		run_bands((Band){.family = GEN_CAVES, .src = src, .dst = dst}, n_threads);
+		uint64_t *tmp = src;
+		src = dst;
+		dst = tmp;
+	}
+	grid_layer_write(GRID_BARRIERS, src);
+	free(src);
+	free(dst);
+	return 1;
+}
+
+/**
+ * Perfect maze with a randomized depth first search.
+ * The passages are the cells with even coordinates, and the
+ * cells in between are the walls knocked down to join them.
+ */
+static int generate_maze(uint64_t seed){
+	int rows = (n_rows + 1) / 2;
+	int cols = (n_cols + 1) / 2;
+	int *stack = malloc(sizeof(int) * rows * cols);
+	bool *seen = calloc(rows * cols, sizeof(bool));
+	if (!stack || !seen){
+		free(stack);
+		free(seen);
+		return -1;
+	}
+	Rng rng;
+	rng_seed(&rng, seed);
+	grid_fill(true);
+
+	int top = 0;
+	int first = rng_range(&rng, rows * cols);
+	stack[top++] = first;
+	seen[first] = true;
+	grid_set(first % cols * 2, first / cols * 2, false);
+
+	static const int dirs[4][2] = {{1, 0}, {-1, 0}, {0, 1}, {0, -1}};
+	while (top > 0){
+		int cell = stack[top - 1];
+		int x = cell % cols;
+		int y = cell / cols;
+		int options[4];
+		int n_options = 0;
+		for (int d = 0; d < 4; d++){
+			int nx = x + dirs[d][0];
+			int ny = y + dirs[d][1];
+			if (nx >= 0 && nx < cols && ny >= 0 && ny < rows && !seen[ny * cols + nx]){
+				options[n_options++] = d;
+			}
+		}
+		if (n_options == 0){
+			top--;
+			continue;
+		}
+		int d = options[rng_range(&rng, n_options)];
+		int nx = x + dirs[d][0];
+		int ny = y + dirs[d][1];
+		seen[ny * cols + nx] = true;
+		grid_set(x * 2 + dirs[d][0], y * 2 + dirs[d][1], false);
+		grid_set(nx * 2, ny * 2, false);
+		stack[top++] = ny * cols + nx;
+	}
+	free(stack);
+	free(seen);
+	return 1;
+}
+
+typedef struct Room {
+	int x, y, w, h;
+} Room;
+
+static void carve(int x0, int y0, int x1, int y1){
+	for (int i = y0; i <= y1; i++){
+		for (int j = x0; j <= x1; j++){
+			grid_set(j, i, false);
+		}
+	}
+}
+
+/**
+ * Rooms that don't overlap, each one joined to the previous
+ * one by an L shaped corridor.
+ */
+static int generate_rooms(uint64_t seed){
+	if (n_rows < 5 || n_cols < 5){
+		grid_fill(false);
+		return 1;
+	}
+	int max_rooms = n_rows * n_cols / 120 + 2;
+	Room *rooms = malloc(sizeof(Room) * max_rooms);
+	if (!rooms){
+		return -1;
+	}
+	Rng rng;
+	rng_seed(&rng, seed);
+	grid_fill(true);
+
+	int max_w = n_cols / 6 > 3 ? n_cols / 6 : 3;
+	int max_h = n_rows / 6 > 3 ? n_rows / 6 : 3;
+	int n_rooms = 0;
+	for (int attempt = 0; attempt < max_rooms * 4 && n_rooms < max_rooms; attempt++){
+		Room r;
+		r.w = 3 + rng_range(&rng, max_w - 2);
+		r.h = 3 + rng_range(&rng, max_h - 2);
+		if (r.w > n_cols - 2 || r.h > n_rows - 2){
+			continue;
+		}
+		r.x = 1 + rng_range(&rng, n_cols - r.w - 1);
+		r.y = 1 + rng_range(&rng, n_rows - r.h - 1);
+		bool overlaps = false;
+		for (int i = 0; i < n_rooms && !overlaps; i++){
+			Room *o = &rooms[i];
+			overlaps = r.x <= o->x + o->w && o->x <= r.x + r.w
+				&& r.y <= o->y + o->h && o->y <= r.y + r.h;
+		}
+		if (overlaps){
+			continue;
+		}
+		carve(r.x, r.y, r.x + r.w - 1, r.y + r.h - 1);
+		if (n_rooms > 0){
+			Room *p = &rooms[n_rooms - 1];
+			int ax = r.x + r.w / 2, ay = r.y + r.h / 2;
+			int bx = p->x + p->w / 2, by = p->y + p->h / 2;
+			int min_x = ax < bx ? ax : bx, max_x = ax < bx ? bx : ax;
+			int min_y = ay < by ? ay : by, max_y = ay < by ? by : ay;
+			if (rng_next(&rng) & 1){
+				carve(min_x, ay, max_x, ay);
+				carve(bx, min_y, bx, max_y);
+			}else{
+				carve(ax, min_y, ax, max_y);
+				carve(min_x, by, max_x, by);
+			}
+		}
+		rooms[n_rooms++] = r;
+	}
+	free(rooms);
+	return 1;
+}
+
+/**
+ * Fills the grid with a map of the given family.
+ * density is the percentage of barriers for GEN_UNIFORM, and the
+ * initial one for GEN_CAVES. The other families ignore it.
+ * Only GEN_UNIFORM and GEN_CAVES are generated in parallel.
+ * The clearance map is rebuilt afterwards.
+ */
+int generate_map(generator_family family, uint64_t seed, int density, int n_threads){
+	if (density < 0){
+		density = 0;
+	}else if (density > 100){
+		density = 100;
+	}
+	int status = -1;
+	switch (family){
+	case GEN_UNIFORM:
+		status = generate_uniform(seed, density, n_threads);
+		break;
+	case GEN_CAVES:
+		status = generate_caves(seed, density, n_threads);
+		break;
+	case GEN_MAZE:
+		status = generate_maze(seed);
+		break;
+	case GEN_ROOMS:
+		status = generate_rooms(seed);
+		break;
+	}
+	if (status == 1){
+		clearance_build();
+		subgoal_build();
+	}
+	return status;
+}
+
+/**
+ * Writes the grid in the Moving AI map format.
+ */
+int write_map(const char *filename){
+	FILE *f = fopen(filename, "w");
+	if (!f){
+		return -1;
+	}
+	fprintf(f, "type octile\nheight %d\nwidth %d\nmap\n", n_rows, n_cols);
+	char *line = malloc(n_cols + 2);
+	if (!line){
+		fclose(f);
+		return -1;
+	}
+	for (int i = 0; i < n_rows; i++){
+		for (int j = 0; j < n_cols; j++){
+			line[j] = grid_get(j, i) ? '@' : '.';
+		}
+		line[n_cols] = '\n';
+		line[n_cols + 1] = '\0';
+		fputs(line, f);
+	}
+	free(line);
+	return fclose(f) == 0 ? 1 : -1;
+}
+
+static double path_cost(Path path){
+	double cost = 0;
+	for (int i = 1; i < path.path_length; i++){
+		int dx = path.path[i].x - path.path[i-1].x;
+		int dy = path.path[i].y - path.path[i-1].y;
+		cost += sqrt(dx * dx + dy * dy);
+	}
+	return cost;
+}
+
+static Coordinates random_free_cell(Rng *rng){
+	Coordinates c;
+	do{
+		c.x = rng_range(rng, n_cols);
+		c.y = rng_range(rng, n_rows);
+	}while(grid_get(c.x, c.y));
+	return c;
+}
+
+/**
+ * Writes n_scenarios random start/goal pairs in the Moving AI
+ * scenario format, with the cost of the optimal path between them.
+ * Only connected pairs are written.
+ */
+int write_scenarios(const char *filename, const char *map_name, int n_scenarios, uint64_t seed){
+	bool any_free = false;
+	for (int i = 0; i < n_rows && !any_free; i++){
+		for (int w = 0; w < grid_row_words && !any_free; w++){
+			uint64_t free_cells = ~grid_row(i)[w];
+			if (w == grid_row_words - 1){
+				free_cells &= grid_tail_mask();
+			}
+			any_free = free_cells != 0;
+		}
+	}
+	if (!any_free){
+		return -1;
+	}
+	FILE *f = fopen(filename, "w");
+	if (!f){
+		return -1;
+	}
+	Rng rng;
+	rng_seed(&rng, seed);
+	fprintf(f, "version 1\n");
+	int written = 0;
+	for (int attempt = 0; written < n_scenarios && attempt < n_scenarios * 100; attempt++){
+		Coordinates start = random_free_cell(&rng);
+		Coordinates goal = random_free_cell(&rng);
+		if (start.x == goal.x && start.y == goal.y){
+			continue;
+		}
+		Path path = find_path(start, goal, heuristic_blind, 1);
+		if (path.path_length <= 1){
+			continue;
+		}
+		double cost = path_cost(path);
+		fprintf(f, "%d\t%s\t%d\t%d\t%d\t%d\t%d\t%d\t%.8f\n",
+			(int)(cost / 4), map_name, n_cols, n_rows,
+			start.x, start.y, goal.x, goal.y, cost);
+		written++;
+	}
+	return fclose(f) == 0 ? 1 : -1;
+}
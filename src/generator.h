@@ -0,0 +1,43 @@
+/**
+ * Seeded map and scenario generator.
+ * The same seed always produces the same grid, no matter
+ * the machine or the number of threads used.
+ */
+#ifndef GENERATOR_H
+#define GENERATOR_H
+
+#include <stdint.h>
+
+// Barrier percentage used by the R key
+#define RANDOM_BARRIERS_DENSITY 40
+
+typedef enum {
+	GEN_UNIFORM,  // Each cell is a barrier with the given density
+	GEN_ROOMS,    // Rectangular rooms joined by corridors
+	GEN_MAZE,     // Perfect maze, one path between any two cells
+	GEN_CAVES,    // Cellular automata caves
+} generator_family;
+
+/**
+ * xoshiro256** pseudo random number generator.
+ */
+typedef struct Rng {
+	uint64_t s[4];
+} Rng;
+
+void rng_seed(Rng *rng, uint64_t seed);
+uint64_t rng_next(Rng *rng);
+uint32_t rng_range(Rng *rng, uint32_t n);
+
+extern uint64_t generator_seed;
+extern int generator_threads;
+
+uint64_t generator_next_seed(void);
+int generator_parse_family(const char *name, generator_family *family);
+
+int generate_map(generator_family family, uint64_t seed, int density, int n_threads);
+
+int write_map(const char *filename);
+int write_scenarios(const char *filename, const char *map_name, int n_scenarios, uint64_t seed);
+
+#endif // GENERATOR_H
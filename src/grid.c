@@ -0,0 +1,342 @@
+/**
+ * Versioned storage of the grid.
+ * The bands are reference counted: every version that holds one
+ * counts, and a band is freed with the last version that held it.
+ * A band that isn't shared can be written in place, any other one
+ * is copied to the working version on its first write.
+ */
+#include "grid.h"
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+extern int n_rows;
+extern int n_cols;
+
+#define BAND_ALIGN 64
+
+struct GridBand {
+	atomic_int refs;
+	unsigned char *data; // Right after the band, or in a mapped snapshot
+};
+
+int grid_row_words;
+size_t grid_row_size[GRID_LAYERS];
+GridVersion *grid_working = NULL;
+_Thread_local GridVersion *grid_view = NULL;
+
+// The version the searches on other threads acquire
+static GridVersion *current = NULL;
+static pthread_mutex_t current_lock = PTHREAD_MUTEX_INITIALIZER;
+static atomic_long live_versions = 0;
+static int n_bands;
+// Storage to use instead of allocating it, like a mapped snapshot
+static unsigned char *attached[GRID_LAYERS];
+
+uint64_t grid_tail_mask(void){
+	int used = n_cols % GRID_WORD_BITS;
+	if (used == 0){
+		return ~(uint64_t)0;
+	}
+	return ((uint64_t)1 << used) - 1;
+}
+
+static inline int band_rows(int band){
+	int rows = n_rows - band * GRID_BAND_ROWS;
+	return rows < GRID_BAND_ROWS ? rows : GRID_BAND_ROWS;
+}
+
+static inline size_t band_size(grid_layer layer, int band){
+	return (size_t)band_rows(band) * grid_row_size[layer];
+}
+
+static GridBand* band_new(grid_layer layer, int band){
+	GridBand *b = malloc(sizeof(GridBand) + BAND_ALIGN + band_size(layer, band));
+	if (!b){
+		return NULL;
+	}
+	atomic_init(&b->refs, 1);
+	uintptr_t data = (uintptr_t)(b + 1);
+	b->data = (unsigned char*)((data + BAND_ALIGN - 1) & ~(uintptr_t)(BAND_ALIGN - 1));
+	return b;
+}
+
+static GridBand* band_wrap(unsigned char *data){
+	GridBand *b = malloc(sizeof(GridBand));
+	if (!b){
+		return NULL;
+	}
+	atomic_init(&b->refs, 1);
+	b->data = data;
+	return b;
+}
+
+static void band_put(GridBand *b){
+	if (b && atomic_fetch_sub(&b->refs, 1) == 1){
+		free(b);
+	}
+}
+
+static GridVersion* version_new(void){
+	size_t table = (size_t)n_bands * (sizeof(unsigned char*) + sizeof(GridBand*) + sizeof(bool));
+	GridVersion *v = calloc(1, sizeof(GridVersion) + GRID_LAYERS * table);
+	if (!v){
+		return NULL;
+	}
+	unsigned char *p = (unsigned char*)(v + 1);
+	for (int l = 0; l < GRID_LAYERS; l++){
+		v->rows[l] = (unsigned char**)p;
+		p += n_bands * sizeof(unsigned char*);
+		v->bands[l] = (GridBand**)p;
+		p += n_bands * sizeof(GridBand*);
+	}
+	for (int l = 0; l < GRID_LAYERS; l++){
+		v->owned[l] = (bool*)p;
+		p += n_bands * sizeof(bool);
+	}
+	atomic_init(&v->refs, 1);
+	atomic_fetch_add(&live_versions, 1);
+	return v;
+}
+
+static void version_put(GridVersion *v){
+	if (!v || atomic_fetch_sub(&v->refs, 1) != 1){
+		return;
+	}
+	for (int l = 0; l < GRID_LAYERS; l++){
+		for (int b = 0; b < n_bands; b++){
+			band_put(v->bands[l][b]);
+		}
+	}
+	free(v);
+	atomic_fetch_sub(&live_versions, 1);
+}
+
+/**
+ * New version that shares every band with v.
+ */
+static GridVersion* version_copy(const GridVersion *v){
+	GridVersion *copy = version_new();
+	if (!copy){
+		return NULL;
+	}
+	for (int l = 0; l < GRID_LAYERS; l++){
+		memcpy(copy->rows[l], v->rows[l], n_bands * sizeof(*v->rows[l]));
+		memcpy(copy->bands[l], v->bands[l], n_bands * sizeof(*v->bands[l]));
+		for (int b = 0; b < n_bands; b++){
+			atomic_fetch_add(&v->bands[l][b]->refs, 1);
+		}
+	}
+	copy->number = v->number;
+	copy->cost_lowest = v->cost_lowest;
+	copy->cost_uniform = v->cost_uniform;
+	return copy;
+}
+
+/**
+ * Makes the band of the working version its own, without copying
+ * what it had, to overwrite it. Returns its first row.
+ */
+static unsigned char* band_replace(grid_layer layer, int band){
+	if (grid_working->owned[layer][band]){
+		return grid_working->rows[layer][band];
+	}
+	GridBand *b = band_new(layer, band);
+	if (!b){
+		abort();
+	}
+	band_put(grid_working->bands[layer][band]);
+	grid_working->bands[layer][band] = b;
+	grid_working->rows[layer][band] = b->data;
+	grid_working->owned[layer][band] = true;
+	grid_working->changed = true;
+	return b->data;
+}
+
+/**
+ * Copies a shared band of the working version, to write it.
+ * Like every write to the grid, it aborts without memory.
+ */
+unsigned char* grid_band_copy(grid_layer layer, int band){
+	const unsigned char *old = grid_working->rows[layer][band];
+	GridBand *b = band_new(layer, band);
+	if (!b){
+		abort();
+	}
+	memcpy(b->data, old, band_size(layer, band));
+	band_put(grid_working->bands[layer][band]);
+	grid_working->bands[layer][band] = b;
+	grid_working->rows[layer][band] = b->data;
+	grid_working->owned[layer][band] = true;
+	return b->data;
+}
+
+int grid_init(void){
+	grid_row_words = (n_cols + GRID_WORD_BITS - 1) / GRID_WORD_BITS;
+	grid_row_size[GRID_BARRIERS] = grid_row_words * sizeof(uint64_t);
+	grid_row_size[GRID_CLEARANCE] = n_cols;
+	grid_row_size[GRID_COSTS] = n_cols;
+	n_bands = (n_rows + GRID_BAND_ROWS - 1) / GRID_BAND_ROWS;
+	grid_working = version_new();
+	if (!grid_working){
+		return -1;
+	}
+	for (int l = 0; l < GRID_LAYERS; l++){
+		for (int b = 0; b < n_bands; b++){
+			GridBand *band;
+			if (attached[l]){
+				band = band_wrap(attached[l] + (size_t)b * GRID_BAND_ROWS * grid_row_size[l]);
+			}else if ((band = band_new(l, b))){
+				memset(band->data, 0, band_size(l, b));
+			}
+			if (!band){
+				grid_free();
+				return -1;
+			}
+			grid_working->bands[l][b] = band;
+			grid_working->rows[l][b] = band->data;
+			grid_working->owned[l][b] = true;
+		}
+	}
+	grid_working->changed = true;
+	grid_view = grid_working;
+	return 1;
+}
+
+void grid_free(void){
+	version_put(current);
+	version_put(grid_working);
+	current = NULL;
+	grid_working = NULL;
+	grid_view = NULL;
+	for (int l = 0; l < GRID_LAYERS; l++){
+		attached[l] = NULL;
+	}
+}
+
+/**
+ * Uses data as the storage of the layer, instead of allocating it.
+ * It must have every row of the layer one after the other, and
+ * outlive the grid. Only before grid_init.
+ */
+void grid_attach(grid_layer layer, void *data){
+	attached[layer] = data;
+}
+
+bool grid_attached(grid_layer layer){
+	return attached[layer];
+}
+
+/**
+ * Sets every cell of the grid to barrier or free.
+ */
+void grid_fill(bool barrier){
+	uint64_t tail = grid_tail_mask();
+	for (int b = 0; b < n_bands; b++){
+		band_replace(GRID_BARRIERS, b);
+	}
+	for (int i = 0; i < n_rows; i++){
+		uint64_t *row = grid_row_mut(i);
+		for (int w = 0; w < grid_row_words; w++){
+			row[w] = barrier ? ~(uint64_t)0 : 0;
+		}
+		row[grid_row_words - 1] &= tail;
+	}
+}
+
+/**
+ * Sets every cell of a layer of one byte per cell to value.
+ */
+void grid_layer_fill(grid_layer layer, int value){
+	for (int b = 0; b < n_bands; b++){
+		memset(band_replace(layer, b), value, band_size(layer, b));
+	}
+}
+
+/**
+ * Copies a layer of the version of the calling thread to data,
+ * with every row one after the other.
+ */
+void grid_layer_read(grid_layer layer, void *data){
+	for (int b = 0; b < n_bands; b++){
+		memcpy((unsigned char*)data + (size_t)b * GRID_BAND_ROWS * grid_row_size[layer],
+		       grid_view->rows[layer][b], band_size(layer, b));
+	}
+}
+
+/**
+ * Replaces a layer of the working version with data, laid out like
+ * in grid_layer_read.
+ */
+void grid_layer_write(grid_layer layer, const void *data){
+	for (int b = 0; b < n_bands; b++){
+		memcpy(band_replace(layer, b), (const unsigned char*)data + (size_t)b * GRID_BAND_ROWS * grid_row_size[layer],
+		       band_size(layer, b));
+	}
+}
+
+/**
+ * Tells that the barriers of the working version changed.
+ */
+void grid_touch(void){
+	grid_working->number++;
+	grid_working->changed = true;
+}
+
+/**
+ * Makes the calling thread read the working version, to edit it.
+ * The caller must keep any other thread from editing it or
+ * publishing it meanwhile, and from reading it while it's edited.
+ */
+void grid_edit(void){
+	grid_view = grid_working;
+}
+
+/**
+ * Makes the working version the current one, if it changed, and
+ * starts a new one from it. Searches that already acquired the
+ * previous version keep it until they release it.
+ */
+void grid_publish(void){
+	if (current && !grid_working->changed){
+		return;
+	}
+	GridVersion *next = version_copy(grid_working);
+	if (!next){
+		// Stays unpublished, it's tried again on the next one
+		return;
+	}
+	pthread_mutex_lock(&current_lock);
+	GridVersion *old = current;
+	current = grid_working;
+	pthread_mutex_unlock(&current_lock);
+	grid_working = next;
+	grid_view = next;
+	version_put(old);
+}
+
+/**
+ * Makes the calling thread read the current version until it's
+ * released, so it doesn't change under a search.
+ */
+GridVersion* grid_acquire(void){
+	pthread_mutex_lock(&current_lock);
+	GridVersion *version = current;
+	atomic_fetch_add(&version->refs, 1);
+	pthread_mutex_unlock(&current_lock);
+	grid_view = version;
+	return version;
+}
+
+void grid_release(GridVersion *version){
+	grid_view = NULL;
+	version_put(version);
+}
+
+/**
+ * Number of versions still held: the working one,
+ * the current one and the ones searches hold.
+ */
+long grid_live_versions(void){
+	return atomic_load(&live_versions);
+}
@@ -0,0 +1,176 @@
+/**
+ * Storage of the grid: the barriers, and the maps of one byte per
+ * cell that go along with them, the clearance and the costs.
+ *
+ * The grid is versioned. A version is a table of bands, of
+ * GRID_BAND_ROWS rows each, for every layer, and the bands are shared
+ * by the versions until they are written (copy on write). Edits go to
+ * the working version, which only the editing thread reads, and
+ * grid_publish makes it the current one. Other threads pin the current
+ * version with grid_acquire, so they read a grid that doesn't change
+ * while the next one is being edited, and a version is freed when the
+ * last thread that holds it releases it.
+ *
+ * Every thread reads the version in grid_view: the editing thread the
+ * working one, and the rest the one they acquired. Rows never cross a
+ * band, so they can still be scanned a word at a time.
+ */
+#ifndef GRID_H
+#define GRID_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdatomic.h>
+
+#define GRID_WORD_BITS 64
+#define GRID_BAND_BITS 4
+#define GRID_BAND_ROWS (1 << GRID_BAND_BITS)
+#define GRID_BAND_MASK (GRID_BAND_ROWS - 1)
+
+typedef enum {
+	GRID_BARRIERS,  // One bit per cell, each row padded to whole words
+	GRID_CLEARANCE, // One byte per cell
+	GRID_COSTS,     // One byte per cell
+	GRID_LAYERS
+} grid_layer;
+
+typedef struct GridBand GridBand;
+
+typedef struct GridVersion {
+	unsigned char **rows[GRID_LAYERS]; // First row of every band
+	GridBand **bands[GRID_LAYERS];
+	bool *owned[GRID_LAYERS];          // Bands no other version holds
+	atomic_int refs;
+	// Bumped on every change to the barriers (by the clearance
+	// map, which is kept up to date with them), so the data
+	// derived from them knows when it's stale
+	unsigned long number;
+	int cost_lowest;
+	bool cost_uniform;
+	bool changed;                      // Since it was last published
+} GridVersion;
+
+extern int n_cols;
+extern int grid_row_words;
+extern size_t grid_row_size[GRID_LAYERS];
+extern GridVersion *grid_working;
+extern _Thread_local GridVersion *grid_view;
+
+static inline const unsigned char* grid_layer_row(grid_layer layer, int y){
+	return grid_view->rows[layer][y >> GRID_BAND_BITS] + (long)(y & GRID_BAND_MASK) * grid_row_size[layer];
+}
+
+unsigned char* grid_band_copy(grid_layer layer, int band);
+
+/**
+ * Row y of the working version, to be written. The
+ * first write to a shared band copies it.
+ */
+static inline unsigned char* grid_layer_row_mut(grid_layer layer, int y){
+	int band = y >> GRID_BAND_BITS;
+	unsigned char *first = grid_working->owned[layer][band]
+		? grid_working->rows[layer][band] : grid_band_copy(layer, band);
+	grid_working->changed = true;
+	return first + (long)(y & GRID_BAND_MASK) * grid_row_size[layer];
+}
+
+static inline const uint64_t* grid_row(int y){
+	return (const uint64_t*)grid_layer_row(GRID_BARRIERS, y);
+}
+
+static inline uint64_t* grid_row_mut(int y){
+	return (uint64_t*)grid_layer_row_mut(GRID_BARRIERS, y);
+}
+
+static inline bool grid_get(int x, int y){
+	return (grid_row(y)[x / GRID_WORD_BITS] >> (x % GRID_WORD_BITS)) & 1;
+}
+
+static inline void grid_set(int x, int y, bool barrier){
+	uint64_t bit = (uint64_t)1 << (x % GRID_WORD_BITS);
+	if (barrier){
+		grid_row_mut(y)[x / GRID_WORD_BITS] |= bit;
+	}else{
+		grid_row_mut(y)[x / GRID_WORD_BITS] &= ~bit;
+	}
+}
+
+static inline unsigned long grid_version(void){
+	return grid_view->number;
+}
+
+/**
+ * Number of barriers of the row y in the columns [x0, x1).
+ */
+static inline int grid_count(int y, int x0, int x1){
+	if (x1 <= x0){
+		return 0;
+	}
+	const uint64_t *row = grid_row(y);
+	int first = x0 / GRID_WORD_BITS;
+	int last = (x1 - 1) / GRID_WORD_BITS;
+	int count = 0;
+	for (int w = first; w <= last; w++){
+		uint64_t word = row[w];
+		if (w == first){
+			word &= ~(uint64_t)0 << (x0 % GRID_WORD_BITS);
+		}
+		if (w == last){
+			word &= ~(uint64_t)0 >> (GRID_WORD_BITS - 1 - (x1 - 1) % GRID_WORD_BITS);
+		}
+		count += __builtin_popcountll(word);
+	}
+	return count;
+}
+
+/**
+ * Whether the row y has any barrier in the columns [x0, x1).
+ */
+static inline bool grid_any(int y, int x0, int x1){
+	if (x1 <= x0){
+		return false;
+	}
+	const uint64_t *row = grid_row(y);
+	int first = x0 / GRID_WORD_BITS;
+	int last = (x1 - 1) / GRID_WORD_BITS;
+	uint64_t head = ~(uint64_t)0 << (x0 % GRID_WORD_BITS);
+	uint64_t tail = ~(uint64_t)0 >> (GRID_WORD_BITS - 1 - (x1 - 1) % GRID_WORD_BITS);
+	if (first == last){
+		return row[first] & head & tail;
+	}
+	if (row[first] & head){
+		return true;
+	}
+	for (int w = first + 1; w < last; w++){
+		if (row[w]){
+			return true;
+		}
+	}
+	return row[last] & tail;
+}
+
+/**
+ * Mask of the bits of the last word of a row
+ * that map to cells. The rest must stay cleared.
+ */
+uint64_t grid_tail_mask(void);
+
+int grid_init(void);
+void grid_free(void);
+void grid_attach(grid_layer layer, void *data);
+bool grid_attached(grid_layer layer);
+
+void grid_fill(bool barrier);
+void grid_layer_fill(grid_layer layer, int value);
+void grid_layer_read(grid_layer layer, void *data);
+void grid_layer_write(grid_layer layer, const void *data);
+void grid_touch(void);
+
+void grid_edit(void);
+void grid_publish(void);
+GridVersion* grid_acquire(void);
+void grid_release(GridVersion *version);
+long grid_live_versions(void);
+
+#endif // GRID_H
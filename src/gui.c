@@ -2,6 +2,12 @@
 #include <stdbool.h>
 #include <SDL2/SDL.h>
 #include "path_finding.h"
+#include "grid.h"
+#include "cost.h"
+#include "session.h"
+#include "trace.h"
+#include "path_code.h"
+#include <math.h>
 
 static SDL_Rect point_a;
 static SDL_Rect point_b;
@@ -16,25 +22,84 @@ static SDL_Color point_color;
 static SDL_Color grid_visited_color = {83, 82, 82, 120};
 static SDL_Color grid_barrier_color = {32, 104, 225, 200};
 static SDL_Color grid_path_color = {246, 204, 46, 250};
+// Of the cells of MAX_BRUSH cost, the cheaper ones are lighter
+static SDL_Color grid_cost_color = {150, 96, 44, 255};
 static SDL_Renderer *renderer;
 static SDL_Window *window;
+// The frame is drawn here, so it can be updated partially.
+// NULL if the renderer doesn't support it.
+static SDL_Texture *canvas;
+// Zoomed out frames are drawn pixel by pixel here
+static SDL_Texture *overview;
+static Uint32 *overview_pixels;
+
+/*
+ * Camera. camera_x and camera_y are the cell (fractional) at the top
+ * left corner of the window, and zoom the side of a cell in pixels.
+ * Below 1 several cells share a pixel, which gets their mixed color.
+ */
+static double camera_x = 0;
+static double camera_y = 0;
+static double zoom;
+static double min_zoom;
+static double max_zoom;
+#define MAX_ZOOM 64.0
+#define ZOOM_STEP 1.25
+// Thinner cells are drawn without lines
+#define GRID_LINES_MIN_ZOOM 4.0
+// Of the screen that the window can take, at most
+#define SCREEN_FRACTION 0.9
 
 // Coordinates
 static Coordinates a_coord;
 static Coordinates b_coord;
 static Coordinates *coord_to_move;
+static Coordinates ghost_coord;
 
 // Flags
 static SDL_bool mouse_active = SDL_FALSE;
 static SDL_bool mouse_hover = SDL_FALSE;
 static SDL_bool re_draw_path = SDL_FALSE;
 static SDL_bool show_visited = SDL_TRUE;
+static SDL_bool click = SDL_FALSE;
+static SDL_bool panning = SDL_FALSE;
+// Set while the search is being animated
+static bool drawing_step = false;
+
+/*
+ * What changed since the last frame. Nothing is drawn
+ * until something does. If only some cells changed, and
+ * they are listed in changed_cells, only those are drawn.
+ */
+enum {
+	DIRTY_CURSOR   = 1 << 0,
+	DIRTY_POINTS   = 1 << 1,
+	DIRTY_BARRIERS = 1 << 2,
+	DIRTY_PATH     = 1 << 3,
+	DIRTY_THEME    = 1 << 4,
+	DIRTY_CAMERA   = 1 << 5,
+	DIRTY_ALL      = 1 << 6,
+};
+#define MAX_CHANGED_CELLS 64
+// Wakes up the loop even without events, just in case
+#define IDLE_TIMEOUT_MS 1000
+static unsigned dirty = DIRTY_ALL;
+static Coordinates changed_cells[MAX_CHANGED_CELLS];
+static int n_changed_cells = 0;
 
 bool animate_search = true;
 
 static bool skip_animation = false;
 
+// Cost painted with the right button, or 0 to put barriers instead
+static int brush = 0;
+#define MAX_BRUSH 9
+
+// Drawn until the next search, in a copy of its own, as the searches
+// only keep their path until the next one on the thread
 Path path = {0};
+static Coordinates *path_cells = NULL;
+static int path_capacity = 0;
 
 // Elements
 
@@ -49,11 +114,20 @@ enum Theme{
 static void set_theme(void);
 static void move_point(int x, int y);
 static void barrier(int x, int y);
+static void paint(int x, int y);
 static void draw_visited();
 static void pre_draw();
 static void post_draw();
 static void process_key_event(SDL_KeyCode key);
 static void draw_path();
+static void mark_cell(Coordinates c);
+static void keep_path(Path found);
+static void render();
+static bool screen_to_cell(int px, int py, int *x, int *y);
+static void zoom_at(double factor, int px, int py);
+static void pan(double dx, double dy);
+static void fit_camera();
+static void process_camera_key(SDL_KeyCode key);
 
 #ifdef __unix__
 #    include <unistd.h>
@@ -64,38 +138,6 @@ static void draw_path();
 #endif
 
 int gui_init(void) {
-	window_width = (n_cols * grid_cell_size) + 1;
-	window_height = (n_rows * grid_cell_size) + 1;
-
-	// Place the points in the middle of the screen.
-	point_a = (SDL_Rect){
-		.x = (n_cols - 1) / 2 * grid_cell_size,
-		.y = (n_rows - 1) / 2 * grid_cell_size,
-		.w = grid_cell_size,
-		.h = grid_cell_size,
-	};
-
-	point_b = (SDL_Rect){
-		.x = point_a.x - 1,
-		.y = point_a.y,
-		.w = point_a.w,
-		.h = point_a.h
-	};
-
-	cursor_ghost = (SDL_Rect){
-		point_a.x,
-		point_a.y,
-		grid_cell_size,
-		grid_cell_size
-	};
-
-	square = (SDL_Rect){
-		point_a.x,
-		point_a.y,
-		grid_cell_size,
-		grid_cell_size
-	};
-
 	set_theme();
 
 	if (SDL_Init(SDL_INIT_VIDEO) < 0) {
@@ -103,42 +145,93 @@ int gui_init(void) {
 		return EXIT_FAILURE;
 	}
 
+	// The window fits the grid, unless it doesn't fit on the screen
+	window_width = (n_cols * grid_cell_size) + 1;
+	window_height = (n_rows * grid_cell_size) + 1;
+	SDL_DisplayMode mode;
+	if (SDL_GetDesktopDisplayMode(0, &mode) == 0){
+		if (window_width > mode.w * SCREEN_FRACTION){
+			window_width = mode.w * SCREEN_FRACTION;
+		}
+		if (window_height > mode.h * SCREEN_FRACTION){
+			window_height = mode.h * SCREEN_FRACTION;
+		}
+	}
+	max_zoom = grid_cell_size > MAX_ZOOM ? grid_cell_size : MAX_ZOOM;
+	fit_camera();
+
+	// Place the points in the middle of the grid.
+	a_coord = (Coordinates){.x = (n_cols - 1) / 2, .y = (n_rows - 1) / 2};
+	b_coord = (Coordinates){.x = a_coord.x - 1, .y = a_coord.y};
+
 	if (SDL_CreateWindowAndRenderer(window_width, window_height, 0, &window, &renderer) < 0) {
 		SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Create window and renderer: %s", SDL_GetError());
 		return EXIT_FAILURE;
 	}
 
 	SDL_SetWindowTitle(window, "Path Finding");
+
+	canvas = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_TARGET,
+				   window_width, window_height);
+	// Copied as it was drawn, like the frames drawn straight to the window,
+	// not blended with the alpha of the colors over the previous frame
+	SDL_SetTextureBlendMode(canvas, SDL_BLENDMODE_NONE);
+	overview = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING,
+				     window_width, window_height);
+	overview_pixels = malloc(sizeof(Uint32) * window_width * window_height);
         return EXIT_SUCCESS;
 }
 
 void gui_loop(void) {
 	SDL_bool quit = SDL_FALSE;
-	SDL_bool click = SDL_FALSE;
 
-	Coordinates last_clicked;
+	Coordinates last_clicked = {0};
 	int last_button_clicked = 0;
 
 	int x;
 	int y;
 
-	a_coord = (Coordinates){.x = point_a.x / grid_cell_size, .y = point_a.y / grid_cell_size};
-	b_coord = (Coordinates){.x = point_b.x / grid_cell_size, .y = point_b.y / grid_cell_size};
 	coord_to_move = &a_coord;
 	while (!quit) {
-		mouse_active = SDL_FALSE;
+		// Sleep until something happens, if there's nothing to do.
+		// While clicking with the animation on, the search waits.
+		bool search_due = re_draw_path && (!animate_search || !click);
+		if (!pending_event && !dirty && !search_due){
+			if (!SDL_WaitEventTimeout(&event, IDLE_TIMEOUT_MS)){
+				continue;
+			}
+			pending_event = true;
+		}
+		trace_begin("events");
 		while (pending_event || SDL_PollEvent(&event)) {
 			switch (event.type) {
 			case SDL_KEYUP:
 				process_key_event(event.key.keysym.sym);
 				break;
+			case SDL_KEYDOWN:
+				process_camera_key(event.key.keysym.sym);
+				break;
+			case SDL_MOUSEWHEEL:
+				SDL_GetMouseState(&x, &y);
+				if (event.wheel.y > 0){
+					zoom_at(ZOOM_STEP, x, y);
+				}else if (event.wheel.y < 0){
+					zoom_at(1 / ZOOM_STEP, x, y);
+				}
+				break;
 			case SDL_MOUSEBUTTONDOWN:
-				x = event.motion.x / grid_cell_size;
-				y = event.motion.y / grid_cell_size;
-				if (x < 0 || x >= n_cols || y < 0 || y >= n_rows){
+				if (event.button.button == SDL_BUTTON_MIDDLE){
+					panning = SDL_TRUE;
+					break;
+				}
+				if (!screen_to_cell(event.button.x, event.button.y, &x, &y)){
 					break;
 				}
 				click = SDL_TRUE;
+				// The path is hidden while clicking with the animation on
+				if (animate_search){
+					dirty |= DIRTY_ALL;
+				}
 				last_clicked.x = x;
 				last_clicked.y = y;
 				last_button_clicked = event.button.button;
@@ -146,24 +239,36 @@ void gui_loop(void) {
 				if (event.button.button == SDL_BUTTON_LEFT){
 					move_point(x,y);
 				}else if (event.button.button == SDL_BUTTON_RIGHT){
-					barrier(x,y);
+					paint(x,y);
 				}
 				break;
 			case SDL_MOUSEBUTTONUP:
+				if (event.button.button == SDL_BUTTON_MIDDLE){
+					panning = SDL_FALSE;
+					break;
+				}
 				click = SDL_FALSE;
+				if (animate_search){
+					dirty |= DIRTY_ALL;
+				}
 				break;
 			case SDL_MOUSEMOTION:
-				x = event.motion.x / grid_cell_size;
-				y = event.motion.y / grid_cell_size;
-				if (x < 0 || x >= n_cols || y < 0 || y >= n_rows){
+				if (panning){
+					pan(-event.motion.xrel / zoom, -event.motion.yrel / zoom);
+				}
+				if (!screen_to_cell(event.motion.x, event.motion.y, &x, &y)){
 					break;
 				}
-				cursor_ghost.x = (event.motion.x / grid_cell_size) * grid_cell_size;
-				cursor_ghost.y = (event.motion.y / grid_cell_size) * grid_cell_size;
+				if (!mouse_active || ghost_coord.x != x || ghost_coord.y != y){
+					mark_cell(ghost_coord);
+					mark_cell((Coordinates){x, y});
+					dirty |= DIRTY_CURSOR;
+				}
+				ghost_coord = (Coordinates){x, y};
 
 				if (click && (last_clicked.x != x || last_clicked.y != y)){
 					if (last_button_clicked == SDL_BUTTON_RIGHT){
-						barrier(x, y);
+						paint(x, y);
 					}else if (last_button_clicked == SDL_BUTTON_LEFT){
 						move_point(x,y);
 					}
@@ -174,10 +279,17 @@ void gui_loop(void) {
 				mouse_active = SDL_TRUE;
 				break;
 			case SDL_WINDOWEVENT:
-				if (event.window.event == SDL_WINDOWEVENT_ENTER && !mouse_hover)
+				if (event.window.event == SDL_WINDOWEVENT_ENTER && !mouse_hover){
 					mouse_hover = SDL_TRUE;
-				else if (event.window.event == SDL_WINDOWEVENT_LEAVE && mouse_hover)
+					mark_cell(ghost_coord);
+					dirty |= DIRTY_CURSOR;
+				}else if (event.window.event == SDL_WINDOWEVENT_LEAVE && mouse_hover){
 					mouse_hover = SDL_FALSE;
+					mark_cell(ghost_coord);
+					dirty |= DIRTY_CURSOR;
+				}else if (event.window.event == SDL_WINDOWEVENT_EXPOSED){
+					dirty |= DIRTY_ALL;
+				}
 				break;
 			case SDL_QUIT:
 				quit = SDL_TRUE;
@@ -185,45 +297,61 @@ void gui_loop(void) {
 			}
 			pending_event = false;
 		}
+		trace_end();
 
 		// Make sure no barrier is set in the two points' coordinates
 		if (get_barrier(a_coord)){
+			session_record(SESSION_BARRIER, a_coord.x, a_coord.y, 0, 0);
 			put_barrier(a_coord);
+			mark_cell(a_coord);
+			dirty |= DIRTY_BARRIERS;
 		}
 		if (get_barrier(b_coord)){
+			session_record(SESSION_BARRIER, b_coord.x, b_coord.y, 0, 0);
 			put_barrier(b_coord);
+			mark_cell(b_coord);
+			dirty |= DIRTY_BARRIERS;
 		}
 
-		pre_draw();
-
 		// Draw path
 		if (re_draw_path && (!animate_search || !click)){
-			path = find_path(a_coord, b_coord, heuristic);
+			session_record(SESSION_PATH, a_coord.x, a_coord.y, b_coord.x, b_coord.y);
+			trace_begin("find_path");
+			keep_path(find_path_selected(a_coord, b_coord));
+			trace_end();
 			re_draw_path = SDL_FALSE;
+			dirty |= DIRTY_PATH;
 			if (animate_search){
 				if (skip_animation){
 					skip_animation = false;
 				}else{
+					trace_begin("sleep");
 					_sleep(200);
+					trace_end();
 				}
 			}
 		}
 
-		if (!(animate_search && click)){
-			draw_path();
-		}
-		post_draw();
-		_sleep(10);
+		render();
 	}
 }
 
 void gui_shutdown(void) {
+	if (canvas){
+		SDL_DestroyTexture(canvas);
+	}
+	if (overview){
+		SDL_DestroyTexture(overview);
+	}
+	free(overview_pixels);
+	free(path_cells);
 	SDL_DestroyRenderer(renderer);
 	SDL_DestroyWindow(window);
 	SDL_Quit();
 }
 
 void take_step(){
+	trace_begin("take_step");
 	if (SDL_PollEvent(&event)){
 		if (event.type == SDL_MOUSEBUTTONDOWN
 		    || event.type == SDL_KEYUP
@@ -234,9 +362,17 @@ void take_step(){
 		pending_event = true;
 	}
 	// TODO: Optimize this! It's called in EVERY step
+	if (canvas){
+		SDL_SetRenderTarget(renderer, canvas);
+	}
+	drawing_step = true;
 	pre_draw();
 	draw_visited();
 	post_draw();
+	drawing_step = false;
+	// The search changed the visited cells
+	dirty |= DIRTY_ALL;
+	trace_end();
 }
 
 /* PRIVATE FUNCTIONS */
@@ -258,7 +394,28 @@ static void set_theme(){
 
 static void barrier(int x, int y){
 	if ((x != a_coord.x || y != a_coord.y) && (x != b_coord.x || y != b_coord.y)){
+		session_record(SESSION_BARRIER, x, y, 0, 0);
 		put_barrier((Coordinates){x, y});
+		mark_cell((Coordinates){x, y});
+		dirty |= DIRTY_BARRIERS;
+		re_draw_path = SDL_TRUE;
+	}
+}
+
+/**
+ * Right button action: a barrier, or the
+ * cost of the brush if one is picked.
+ */
+static void paint(int x, int y){
+	if (!brush){
+		barrier(x, y);
+		return;
+	}
+	if (cost_get(x, y) != brush){
+		session_record(SESSION_COST, x, y, brush, 0);
+		cost_set(x, y, brush);
+		mark_cell((Coordinates){x, y});
+		dirty |= DIRTY_BARRIERS;
 		re_draw_path = SDL_TRUE;
 	}
 }
@@ -272,8 +429,11 @@ static void move_point(int x, int y){
 	}else if (x == b_coord.x && y == b_coord.y){
 		coord_to_move = &b_coord;
 	}else {
+		mark_cell(*coord_to_move);
 		coord_to_move->x = x;
 		coord_to_move->y = y;
+		mark_cell(*coord_to_move);
+		dirty |= DIRTY_POINTS;
 		re_draw_path = SDL_TRUE;
 	}
 }
@@ -285,6 +445,7 @@ static void process_key_event(SDL_KeyCode key){
 		a_coord.y = n_rows - 1;
 		b_coord.x = n_cols - 1;
 		b_coord.y = 0;
+		session_record(SESSION_MAZE, a_coord.x, a_coord.y, b_coord.x, b_coord.y);
 		prepare_maze(a_coord, b_coord);
 		re_draw_path = SDL_TRUE;
 		skip_animation = true;
@@ -294,44 +455,334 @@ static void process_key_event(SDL_KeyCode key){
 		a_coord.y = (n_rows - 1) / 2;
 		b_coord.x = (n_cols - 1) / 2 - 1;
 		b_coord.y = (n_rows - 1) / 2;
+		session_record(SESSION_CLEAR, 0, 0, 0, 0);
 		clear_barriers();
 		re_draw_path = SDL_TRUE;
 		skip_animation = true;
 		break;
 	case SDLK_v:
 		show_visited = !show_visited;
+		dirty |= DIRTY_ALL;
 		break;
 	case SDLK_t:
 		theme = theme == DARK ? LIGHT : DARK;
 		set_theme();
+		dirty |= DIRTY_THEME;
 		break;
 	case SDLK_h:
+		session_record(SESSION_MOVEMENT, 0, 0, 0, 0);
 		switch_horizontal_movement();
 		re_draw_path = SDL_TRUE;
 		break;
 	case SDLK_a:
 		animate_search = !animate_search;
 		re_draw_path = SDL_TRUE;
+		dirty |= DIRTY_ALL;
 		break;
 	case SDLK_r:
-		random_barriers(a_coord, b_coord);
+		session_record(SESSION_RANDOM, a_coord.x, a_coord.y, b_coord.x, b_coord.y);
+		if (random_barriers(a_coord, b_coord) != 1){
+			SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Generate random barriers: out of memory");
+			break;
+		}
 		re_draw_path = SDL_TRUE;
 		break;
         case SDLK_F5:
 		re_draw_path = SDL_TRUE;
 		break;
 	default:
+		if (key >= SDLK_0 && key <= SDLK_0 + MAX_BRUSH){
+			brush = key - SDLK_0;
+		}
 		break;
 	}
 }
 
+/**
+ * Left edge of the column x, in pixels. A cell ends
+ * where the next one starts, so there are no gaps.
+ */
+static inline int cell_left(int x){
+	return (int)floor((x - camera_x) * zoom);
+}
+
+static inline int cell_top(int y){
+	return (int)floor((y - camera_y) * zoom);
+}
+
+/**
+ * Sets r to the area of the window covered by the cell c.
+ * Returns false if it's not visible.
+ */
+static bool cell_rect(Coordinates c, SDL_Rect *r){
+	r->x = cell_left(c.x);
+	r->y = cell_top(c.y);
+	r->w = cell_left(c.x + 1) - r->x;
+	r->h = cell_top(c.y + 1) - r->y;
+	if (r->w < 1){
+		r->w = 1;
+	}
+	if (r->h < 1){
+		r->h = 1;
+	}
+	return r->x < window_width && r->y < window_height && r->x + r->w > 0 && r->y + r->h > 0;
+}
+
+/**
+ * Sets [x0, x1) x [y0, y1) to the cells that are
+ * (at least partially) inside the window.
+ */
+static void visible_cells(int *x0, int *y0, int *x1, int *y1){
+	*x0 = camera_x < 0 ? 0 : (int)camera_x;
+	*y0 = camera_y < 0 ? 0 : (int)camera_y;
+	*x1 = (int)ceil(camera_x + window_width / zoom);
+	*y1 = (int)ceil(camera_y + window_height / zoom);
+	if (*x1 > n_cols){
+		*x1 = n_cols;
+	}
+	if (*y1 > n_rows){
+		*y1 = n_rows;
+	}
+}
+
+static bool screen_to_cell(int px, int py, int *x, int *y){
+	*x = (int)floor(camera_x + px / zoom);
+	*y = (int)floor(camera_y + py / zoom);
+	return *x >= 0 && *x < n_cols && *y >= 0 && *y < n_rows;
+}
+
+/**
+ * Keeps the camera over the grid. If the grid is smaller
+ * than the window, it stays at the top left corner.
+ */
+static void clamp_camera(){
+	double max_x = n_cols - window_width / zoom;
+	double max_y = n_rows - window_height / zoom;
+	camera_x = camera_x > max_x ? max_x : camera_x;
+	camera_y = camera_y > max_y ? max_y : camera_y;
+	camera_x = camera_x < 0 ? 0 : camera_x;
+	camera_y = camera_y < 0 ? 0 : camera_y;
+}
+
+/**
+ * Shows the whole grid, with cells of grid_cell_size
+ * pixels if it fits, or smaller otherwise.
+ */
+static void fit_camera(){
+	double fit_x = (double)(window_width - 1) / n_cols;
+	double fit_y = (double)(window_height - 1) / n_rows;
+	double fit = fit_x < fit_y ? fit_x : fit_y;
+	zoom = fit < grid_cell_size ? fit : grid_cell_size;
+	min_zoom = zoom < 1 ? zoom : 1;
+	camera_x = 0;
+	camera_y = 0;
+	dirty |= DIRTY_CAMERA;
+}
+
+/**
+ * Zooms by factor, keeping the cell under the pixel (px, py) in place.
+ */
+static void zoom_at(double factor, int px, int py){
+	double new_zoom = zoom * factor;
+	if (new_zoom < min_zoom){
+		new_zoom = min_zoom;
+	}else if (new_zoom > max_zoom){
+		new_zoom = max_zoom;
+	}
+	double x = camera_x + px / zoom;
+	double y = camera_y + py / zoom;
+	zoom = new_zoom;
+	camera_x = x - px / zoom;
+	camera_y = y - py / zoom;
+	clamp_camera();
+	dirty |= DIRTY_CAMERA;
+}
+
+/**
+ * Moves the camera by (dx, dy) cells.
+ */
+static void pan(double dx, double dy){
+	camera_x += dx;
+	camera_y += dy;
+	clamp_camera();
+	dirty |= DIRTY_CAMERA;
+}
+
+static void process_camera_key(SDL_KeyCode key){
+	double step_x = window_width / zoom / 8;
+	double step_y = window_height / zoom / 8;
+	switch (key){
+	case SDLK_LEFT:
+		pan(-step_x, 0);
+		break;
+	case SDLK_RIGHT:
+		pan(step_x, 0);
+		break;
+	case SDLK_UP:
+		pan(0, -step_y);
+		break;
+	case SDLK_DOWN:
+		pan(0, step_y);
+		break;
+	case SDLK_PLUS:
+	case SDLK_EQUALS:
+	case SDLK_KP_PLUS:
+		zoom_at(ZOOM_STEP, window_width / 2, window_height / 2);
+		break;
+	case SDLK_MINUS:
+	case SDLK_KP_MINUS:
+		zoom_at(1 / ZOOM_STEP, window_width / 2, window_height / 2);
+		break;
+	case SDLK_HOME:
+		fit_camera();
+		break;
+	default:
+		break;
+	}
+}
+
+static inline Uint32 pixel_color(SDL_Color c){
+	return (Uint32)0xFF << 24 | (Uint32)c.r << 16 | (Uint32)c.g << 8 | c.b;
+}
+
+static inline SDL_Color blend(SDL_Color a, SDL_Color b, double t){
+	return (SDL_Color){
+		a.r + (b.r - a.r) * t,
+		a.g + (b.g - a.g) * t,
+		a.b + (b.b - a.b) * t,
+		255
+	};
+}
+
+static inline Uint32 mix_colors(SDL_Color a, SDL_Color b, double t){
+	return pixel_color(blend(a, b, t));
+}
+
+/**
+ * Background of a cell of cost c. Costs above
+ * MAX_BRUSH look like it.
+ */
+static SDL_Color cost_color(int c){
+	if (c <= COST_DEFAULT){
+		return grid_background;
+	}
+	double t = c >= MAX_BRUSH ? 1.0 : (double)(c - COST_DEFAULT) / (MAX_BRUSH - COST_DEFAULT);
+	return blend(grid_background, grid_cost_color, 0.25 + 0.75 * t);
+}
+
+static inline bool painted(){
+	return !cost_uniform() || cost_lowest() != COST_DEFAULT;
+}
+
+/**
+ * Draws the grid when a pixel covers several cells. Each pixel gets
+ * the color of the barriers mixed with the background, in the
+ * proportion they take of its block of cells. Counting them is cheap
+ * with the bitmap, but the visited cells would need to read every
+ * node, so only the first one of each block is checked.
+ */
+static void draw_overview(bool visited){
+	if (!overview || !overview_pixels){
+		return;
+	}
+	int x0, y0, x1, y1;
+	visible_cells(&x0, &y0, &x1, &y1);
+	// Block of columns of every pixel column
+	int first_col[window_width + 1];
+	for (int px = 0; px <= window_width; px++){
+		int x = (int)floor(camera_x + px / zoom);
+		first_col[px] = x < x1 ? x : x1;
+	}
+	Uint32 background = pixel_color(grid_background);
+	bool costs = painted();
+	int count[window_width];
+	int py = 0;
+	for (; py < window_height; py++){
+		int row = (int)floor(camera_y + py / zoom);
+		int next_row = (int)floor(camera_y + (py + 1) / zoom);
+		if (row >= y1){
+			break;
+		}
+		next_row = next_row > y1 ? y1 : next_row;
+		Uint32 *pixels = &overview_pixels[(long)py * window_width];
+		for (int px = 0; px < window_width; px++){
+			count[px] = 0;
+		}
+		for (int y = row; y < next_row; y++){
+			for (int px = 0; px < window_width && first_col[px] < x1; px++){
+				count[px] += grid_count(y, first_col[px], first_col[px + 1]);
+			}
+		}
+		for (int px = 0; px < window_width; px++){
+			int x = first_col[px];
+			int area = (first_col[px + 1] - x) * (next_row - row);
+			if (area <= 0){
+				pixels[px] = background;
+				continue;
+			}
+			SDL_Color base = costs ? cost_color(cost_get(x, row)) : grid_background;
+			if (visited && get_visited((Coordinates){x, row}) && !get_barrier((Coordinates){x, row})){
+				base = grid_visited_color;
+			}
+			pixels[px] = mix_colors(base, grid_barrier_color, (double)count[px] / area);
+		}
+	}
+	for (; py < window_height; py++){
+		for (int px = 0; px < window_width; px++){
+			overview_pixels[(long)py * window_width + px] = background;
+		}
+	}
+	SDL_UpdateTexture(overview, NULL, overview_pixels, window_width * sizeof(Uint32));
+	SDL_RenderCopy(renderer, overview, NULL, NULL);
+}
+
+/**
+ * Rect of a point, big enough to be seen when zoomed out.
+ */
+static void point_rect(Coordinates c, SDL_Rect *r){
+	cell_rect(c, r);
+	if (r->w < 3){
+		r->x -= (3 - r->w) / 2;
+		r->y -= (3 - r->h) / 2;
+		r->w = 3;
+		r->h = 3;
+	}
+}
+
+/**
+ * Draws the visible cells that don't cost COST_DEFAULT.
+ */
+static void draw_costs(){
+	int x0, y0, x1, y1;
+	visible_cells(&x0, &y0, &x1, &y1);
+	for (int i = y0; i < y1; i++){
+		for (int j = x0; j < x1; j++){
+			int c = cost_get(j, i);
+			if (c != COST_DEFAULT){
+				SDL_Color color = cost_color(c);
+				SDL_SetRenderDrawColor(renderer, color.r, color.g, color.b, color.a);
+				cell_rect((Coordinates){j, i}, &square);
+				SDL_RenderFillRect(renderer, &square);
+			}
+		}
+	}
+}
+
 static void pre_draw(){
+	trace_begin("pre_draw");
 	// Draw grid background.
 	SDL_SetRenderDrawColor(renderer, grid_background.r, grid_background.g, grid_background.b, grid_background.a);
 	SDL_RenderClear(renderer);
 
+	if (zoom < 1){
+		bool visited = drawing_step || (show_visited && !(animate_search && click));
+		draw_overview(visited);
+	}else if (painted()){
+		draw_costs();
+	}
+
 	// Draw grid ghost cursor.
-	if (mouse_active && mouse_hover) {
+	if (mouse_active && mouse_hover && zoom >= 1) {
 		SDL_SetRenderDrawColor(
 			renderer,
 			cursor_ghost_color.r,
@@ -339,14 +790,13 @@ static void pre_draw(){
 			cursor_ghost_color.b,
 			cursor_ghost_color.a
 			);
+		cell_rect(ghost_coord, &cursor_ghost);
 		SDL_RenderFillRect(renderer, &cursor_ghost);
 	}
 
 	// Draw grid cursor.
-	point_a.x = a_coord.x * grid_cell_size;
-	point_a.y = a_coord.y * grid_cell_size;
-	point_b.x = b_coord.x * grid_cell_size;
-	point_b.y = b_coord.y * grid_cell_size;
+	point_rect(a_coord, &point_a);
+	point_rect(b_coord, &point_b);
 	SDL_SetRenderDrawColor(
 		renderer,
 		point_color.r,
@@ -357,21 +807,29 @@ static void pre_draw(){
 	SDL_RenderFillRect(renderer, &point_a);
 	SDL_RenderFillRect(renderer, &point_b);
 
+	if (zoom < 1){
+		trace_end();
+		return;
+	}
+
 	// Draw barriers
 	SDL_SetRenderDrawColor(renderer, grid_barrier_color.r, grid_barrier_color.g, grid_barrier_color.b, grid_barrier_color.a);
 
-	for (int i = 0; i < n_rows; i++){
-		for (int j = 0; j < n_cols; j++){
+	int x0, y0, x1, y1;
+	visible_cells(&x0, &y0, &x1, &y1);
+	for (int i = y0; i < y1; i++){
+		for (int j = x0; j < x1; j++){
 			if (get_barrier((Coordinates){j, i})){
-				square.x = j * grid_cell_size;
-				square.y = i * grid_cell_size;
+				cell_rect((Coordinates){j, i}, &square);
 				SDL_RenderFillRect(renderer, &square);
 			}
 		}
 	}
+	trace_end();
 }
 
 static void post_draw(){
+	trace_begin("post_draw");
 	// Draw grid lines.
 	SDL_SetRenderDrawColor(
 		renderer,
@@ -381,40 +839,195 @@ static void post_draw(){
 		grid_line_color.a
 		);
 
-	for (int x = 0; x < 1 + n_cols * grid_cell_size;
-	     x += grid_cell_size) {
-		SDL_RenderDrawLine(renderer, x, 0, x, window_height);
+	if (zoom >= GRID_LINES_MIN_ZOOM){
+		int x0, y0, x1, y1;
+		visible_cells(&x0, &y0, &x1, &y1);
+		int bottom = cell_top(y1);
+		int right = cell_left(x1);
+		for (int x = x0; x <= x1; x++) {
+			SDL_RenderDrawLine(renderer, cell_left(x), cell_top(y0), cell_left(x), bottom);
+		}
+		for (int y = y0; y <= y1; y++) {
+			SDL_RenderDrawLine(renderer, cell_left(x0), cell_top(y), right, cell_top(y));
+		}
 	}
 
-	for (int y = 0; y < 1 + n_rows * grid_cell_size;
-	     y += grid_cell_size) {
-		SDL_RenderDrawLine(renderer, 0, y, window_width, y);
+	if (canvas){
+		SDL_SetRenderTarget(renderer, NULL);
+		SDL_RenderCopy(renderer, canvas, NULL, NULL);
 	}
-
 	SDL_RenderPresent(renderer);
+	trace_end();
 }
 
 static void draw_visited(){
+	// Zoomed out, they are part of the overview
+	if (zoom < 1){
+		return;
+	}
 	SDL_SetRenderDrawColor(renderer, grid_visited_color.r, grid_visited_color.g, grid_visited_color.b, grid_visited_color.a);
-	for (int i = 0; i < n_rows; i++){
-		for (int j = 0; j < n_cols; j++){
+	int x0, y0, x1, y1;
+	visible_cells(&x0, &y0, &x1, &y1);
+	for (int i = y0; i < y1; i++){
+		for (int j = x0; j < x1; j++){
 			if (get_visited((Coordinates){j, i}) && !get_barrier((Coordinates){j, i}) && (j != a_coord.x || i != a_coord.y) && (j != b_coord.x || i != b_coord.y)){
-				square.x = j * grid_cell_size;
-				square.y = i * grid_cell_size;
+				cell_rect((Coordinates){j, i}, &square);
 				SDL_RenderFillRect(renderer, &square);
 			}
 		}
 	}
 }
 
+/**
+ * Draws an any-angle path as straight lines
+ * between the centers of its waypoints.
+ */
+static void draw_segments(){
+	SDL_SetRenderDrawColor(renderer, grid_path_color.r, grid_path_color.g, grid_path_color.b, grid_path_color.a);
+	int half = (int)(zoom / 2);
+	for (int i = 0; i + 1 < path.path_length; i++){
+		Coordinates a = path.path[i], b = path.path[i+1];
+		SDL_RenderDrawLine(renderer, cell_left(a.x) + half, cell_top(a.y) + half,
+		                             cell_left(b.x) + half, cell_top(b.y) + half);
+	}
+}
+
 static void draw_path(){
 	if (show_visited){
 		draw_visited();
 	}
 	SDL_SetRenderDrawColor(renderer, grid_path_color.r, grid_path_color.g, grid_path_color.b, grid_path_color.a);
 	for (int i = 1; i < path.path_length-1; i++){
-		square.x = path.path[i].x * grid_cell_size;
-		square.y = path.path[i].y * grid_cell_size;
-		SDL_RenderFillRect(renderer, &square);
+		if (cell_rect(path.path[i], &square)){
+			SDL_RenderFillRect(renderer, &square);
+		}
+	}
+	if (any_angle){
+		draw_segments();
+	}
+}
+
+/**
+ * Queues the cell at c to be drawn in the next frame.
+ * If there are too many, the whole frame is drawn.
+ */
+static void mark_cell(Coordinates c){
+	if (n_changed_cells < MAX_CHANGED_CELLS){
+		changed_cells[n_changed_cells++] = c;
+	}else{
+		dirty |= DIRTY_ALL;
+	}
+}
+
+/**
+ * Copies the path found to be drawn. If there's no memory
+ * for it, the search's own is drawn instead.
+ */
+static void keep_path(Path found){
+	if (found.path_length > path_capacity){
+		int capacity = path_capacity ? path_capacity : 256;
+		while (capacity < found.path_length){
+			capacity *= 2;
+		}
+		Coordinates *cells = realloc(path_cells, sizeof(Coordinates) * capacity);
+		if (!cells){
+			path = found;
+			return;
+		}
+		path_cells = cells;
+		path_capacity = capacity;
+	}
+	path_copy(found, path_cells, path_capacity);
+	path = (Path){.path = path_cells, .path_length = found.path_length, .bound = found.bound};
+}
+
+static bool in_path(Coordinates c){
+	for (int i = 1; i < path.path_length-1; i++){
+		if (path.path[i].x == c.x && path.path[i].y == c.y){
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * Draws a single cell, with the same layers as the whole frame:
+ * the ghost cursor, the points, the barriers, the visited cells
+ * and the path, each over the previous one.
+ */
+static void draw_cell(Coordinates c){
+	bool is_point = (c.x == a_coord.x && c.y == a_coord.y) || (c.x == b_coord.x && c.y == b_coord.y);
+	bool barrier = get_barrier(c);
+	SDL_Color color = cost_color(cost_get(c.x, c.y));
+	if (mouse_active && mouse_hover && c.x == ghost_coord.x && c.y == ghost_coord.y){
+		color = cursor_ghost_color;
+	}
+	if (is_point){
+		color = point_color;
+	}
+	if (barrier){
+		color = grid_barrier_color;
+	}
+	if (!(animate_search && click)){
+		if (show_visited && get_visited(c) && !barrier && !is_point){
+			color = grid_visited_color;
+		}
+		if (in_path(c)){
+			color = grid_path_color;
+		}
+	}
+	if (!cell_rect(c, &square)){
+		return;
+	}
+	SDL_SetRenderDrawColor(renderer, color.r, color.g, color.b, color.a);
+	SDL_RenderFillRect(renderer, &square);
+
+	if (zoom >= GRID_LINES_MIN_ZOOM){
+		int x0 = square.x, y0 = square.y;
+		int x1 = x0 + square.w, y1 = y0 + square.h;
+		SDL_SetRenderDrawColor(renderer, grid_line_color.r, grid_line_color.g, grid_line_color.b, grid_line_color.a);
+		SDL_RenderDrawLine(renderer, x0, y0, x1, y0);
+		SDL_RenderDrawLine(renderer, x0, y1, x1, y1);
+		SDL_RenderDrawLine(renderer, x0, y0, x0, y1);
+		SDL_RenderDrawLine(renderer, x1, y0, x1, y1);
+	}
+	// The segments that cross the cell were painted over
+	if (any_angle && !(animate_search && click)){
+		SDL_RenderSetClipRect(renderer, &square);
+		draw_segments();
+		SDL_RenderSetClipRect(renderer, NULL);
+	}
+}
+
+/**
+ * Draws the frame, if anything changed. Without a canvas
+ * the previous frame is lost, so it's always drawn whole.
+ */
+static void render(){
+	if (!dirty){
+		return;
+	}
+	trace_begin("render");
+	// Zoomed out, a cell can't be drawn alone
+	bool partial = canvas && zoom >= 1 && !(dirty & (DIRTY_PATH | DIRTY_THEME | DIRTY_CAMERA | DIRTY_ALL));
+	if (canvas){
+		SDL_SetRenderTarget(renderer, canvas);
+	}
+	if (partial){
+		for (int i = 0; i < n_changed_cells; i++){
+			draw_cell(changed_cells[i]);
+		}
+		SDL_SetRenderTarget(renderer, NULL);
+		SDL_RenderCopy(renderer, canvas, NULL, NULL);
+		SDL_RenderPresent(renderer);
+	}else{
+		pre_draw();
+		if (!(animate_search && click)){
+			draw_path();
+		}
+		post_draw();
 	}
+	dirty = 0;
+	n_changed_cells = 0;
+	trace_end();
 }
@@ -1,6 +1,7 @@
 #include "heuristic.h"
 
 #include <math.h>
+#include <string.h>
 #define abs(n) ((n) < 0 ? -(n) : (n))
 #define max(a,b) ((a) >= (b) ? (a) : (b))
 
@@ -27,3 +28,19 @@ double heuristic_blind(Coordinates c1, Coordinates c2){
 	(void) c2;
 	return 0;
 }
+
+/**
+ * Returns the heuristic with the given name, or NULL if there's none.
+ */
+heuristic_function heuristic_from_name(const char *name){
+	if (strcmp(name, "blind") == 0){
+		return heuristic_blind;
+	}else if (strcmp(name, "manhatan") == 0){
+		return heuristic_manhatan;
+	}else if (strcmp(name, "euclidean") == 0){
+		return heuristic_euclidean;
+	}else if (strcmp(name, "diagonal") == 0){
+		return heuristic_diagonal;
+	}
+	return NULL;
+}
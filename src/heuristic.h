@@ -16,4 +16,6 @@ double heuristic_diagonal(Coordinates c1, Coordinates c2);
 
 double heuristic_blind(Coordinates c1, Coordinates c2);
 
+heuristic_function heuristic_from_name(const char *name);
+
 #endif // _HEURISTIC_H
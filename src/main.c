@@ -5,24 +5,159 @@
 #define SDL_MAIN_HANDLED
 #include <SDL2/SDL.h>
 #include <stdio.h>
+#include <string.h>
 #include "gui.h"
 #include "path_finding.h"
 #include "args.h"
+#include "generator.h"
+#include "snapshot.h"
+#include "server.h"
+#include "cpd.h"
+#include "subgoal.h"
+#include "session.h"
+#include "trace.h"
 
+/**
+ * Writes the grid and its scenarios to disk, for benchmarks.
+ */
+static int export_grid(const char *prefix){
+	char map_file[strlen(prefix) + sizeof(".map.scen")];
+	sprintf(map_file, "%s.map", prefix);
+	if (write_map(map_file) != 1){
+		fprintf(stderr, "Error writing %s\n", map_file);
+		return EXIT_FAILURE;
+	}
+	// The search must not be rendered, there's no window
+	animate_search = false;
+	char scen_file[sizeof(map_file)];
+	sprintf(scen_file, "%s.map.scen", prefix);
+	const char *map_name = strrchr(map_file, '/');
+	map_name = map_name ? map_name + 1 : map_file;
+	if (n_scenarios > 0 && write_scenarios(scen_file, map_name, n_scenarios, generator_next_seed()) != 1){
+		fprintf(stderr, "Error writing %s\n", scen_file);
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
+
+/**
+ * Takes the path database from the snapshot, if it has one for this
+ * grid, or else builds it if it was asked for.
+ */
+static int setup_cpd(void){
+	uint64_t size;
+	const void *data = snapshot_section(SNAPSHOT_CPD, &size);
+	if (data && !generate){
+		if (cpd_attach(data, size) == 1 && (!snapshot_check || cpd_verify() == 1)){
+			return 1;
+		}
+		cpd_free();
+		fprintf(stderr, "The path database of snapshot %s is corrupt, it's not used\n", snapshot_in);
+	}
+	if (cpd_threads <= 0){
+		return 1;
+	}
+	if (cpd_build(cpd_threads) != 1){
+		return -1;
+	}
+	CpdStats stats = cpd_stats();
+	// Not on stdout, it may be serving queries
+	fprintf(stderr, "Path database: %ld sources, %.1f runs per source, %.1f MB, built in %.2f s with %d threads\n",
+		stats.n_sources, stats.n_sources ? (double)stats.n_runs / stats.n_sources : 0.0,
+		stats.bytes / 1e6, stats.build_seconds, cpd_threads);
+	return 1;
+}
 
 int main(int argc, char *argv[]){
         args_parse(argc, argv);
+	if (trace_out){
+		if (trace_start(trace_out) != 1){
+			fprintf(stderr, "Error opening the trace %s\n", trace_out);
+			return 1;
+		}
+		// Written on every way out
+		atexit(trace_stop);
+	}
+	if (snapshot_in && snapshot_load(snapshot_in) != 1){
+		fprintf(stderr, "Error loading snapshot %s\n", snapshot_in);
+		return 1;
+	}
+	if (snapshot_in && snapshot_check && snapshot_verify() != 1){
+		fprintf(stderr, "Snapshot %s is corrupt\n", snapshot_in);
+		return 1;
+	}
+	if (session_in){
+		if (snapshot_in){
+			fprintf(stderr, "A session can't be replayed over a snapshot\n");
+			return 1;
+		}
+		if (session_load(session_in) != 1){
+			fprintf(stderr, "Error loading session %s\n", session_in);
+			return 1;
+		}
+	}
 	if (path_finding_init() != 1){
 		fprintf(stderr, "Error at path_finding_init\n");
 		return 1;
 	}
+	if (generate && generate_map(family, generator_next_seed(), density, generator_threads) != 1){
+		fprintf(stderr, "Error generating the grid\n");
+		return 1;
+	}
+	if (setup_cpd() != 1){
+		fprintf(stderr, "Error building the path database\n");
+		return 1;
+	}
+	if (use_subgoals){
+		if (subgoal_init() != 1){
+			fprintf(stderr, "Error building the subgoal graph\n");
+			return 1;
+		}
+		SubgoalStats stats = subgoal_stats();
+		fprintf(stderr, "Subgoal graph: %d subgoals, %ld edges, built in %.3f s\n",
+			stats.n_subgoals, stats.n_edges, stats.build_seconds);
+	}
+	if (export_prefix || snapshot_out){
+		int status = EXIT_SUCCESS;
+		if (export_prefix){
+			status = export_grid(export_prefix);
+		}
+		if (snapshot_out && snapshot_save(snapshot_out) != 1){
+			fprintf(stderr, "Error saving snapshot %s\n", snapshot_out);
+			status = EXIT_FAILURE;
+		}
+		path_finding_free();
+		snapshot_unload();
+		return status;
+	}
+	if (serve_socket){
+		animate_search = false;
+		int status = serve(serve_socket, n_workers);
+		path_finding_free();
+		snapshot_unload();
+		return status;
+	}
+	if (session_in){
+		animate_search = false;
+		int status = session_replay() == 1 ? EXIT_SUCCESS : EXIT_FAILURE;
+		path_finding_free();
+		session_unload();
+		return status;
+	}
         if (gui_init() != EXIT_SUCCESS)
                 return EXIT_FAILURE;
+	if (session_out && session_record_start(session_out) != 1){
+		fprintf(stderr, "Error recording to %s\n", session_out);
+		gui_shutdown();
+		return EXIT_FAILURE;
+	}
 
         gui_loop();
 
+	session_record_stop();
         gui_shutdown();
 	path_finding_free();
+	snapshot_unload();
 	return EXIT_SUCCESS;
 }
 
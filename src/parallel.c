@@ -0,0 +1,453 @@
+/**
+ * Hash distributed A* (HDA*).
+ * A single query is searched by several threads. The grid is split
+ * in tiles, and every tile is owned by a thread, chosen by a hash of
+ * its position. Each thread has its own open list with the nodes it
+ * owns, and is the only one that writes them. The children that
+ * belong to another thread are sent to it in batches, through a lock
+ * free stack per thread. Tiles keep most of the children with the
+ * thread that generated them, so few of them need to be sent.
+ *
+ * The search ends when no thread has a node that could improve the
+ * best path to the goal found so far (the incumbent), and no batch
+ * is on its way. That's tracked by a single counter, work, which
+ * adds the threads that are busy and the batches not received yet.
+ *
+ * Like the rest of the search state, everything is kept per calling
+ * thread, so several threads can run their own queries at once, each
+ * one with its own workers. The workers reach it through a pointer.
+ *
+ * The nodes are kept from one query to the next, and told apart by
+ * their stamp. Everything else comes from arenas, which are reset on
+ * every query, so once they have grown the queries don't allocate.
+ * The batches come from the arena of the thread that sends them, and
+ * are kept by the thread that receives them, to send its own.
+ */
+#include "path_finding.h"
+#include "grid.h"
+#include "heap.h"
+#include "clearance.h"
+#include "cost.h"
+#include "arena.h"
+#include "trace.h"
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
+#include <float.h>
+#include <math.h>
+#include <string.h>
+
+extern int n_rows;
+extern int n_cols;
+extern bool horizontal_movement;
+
+#define TILE_SIDE 16
+#define BATCH_SIZE 256
+// Expansions between sending the partial batches
+#define FLUSH_INTERVAL 64
+#define MAX_THREADS 256
+
+typedef struct Message {
+	int node;
+	int parent;
+	double g;
+} Message;
+
+typedef struct Batch {
+	struct Batch *next;
+	int n_messages;
+	Message messages[BATCH_SIZE];
+} Batch;
+
+typedef struct Hda Hda;
+
+typedef struct Worker {
+	Hda *hda;
+	int id;
+	Heap open;
+	_Atomic(Batch*) inbox;
+	Batch **outbox;  // One per thread, being filled
+	Batch *free_batches;
+	Arena *batches;  // Where its batches come from
+	pthread_t thread;
+} Worker;
+
+struct Hda {
+	Node *nodes;
+	unsigned stamp;
+	Worker *workers;
+	int n_threads;
+	int tiles_per_row;
+	Coordinates end;
+	heuristic_function heuristic;
+	int needed;
+	// Like in find_path, the costs are skipped when they are uniform
+	bool uniform_cost;
+	int cost_unit;
+	GridVersion *view;  // Of the calling thread, which the workers read too
+	_Atomic double incumbent;
+	atomic_long work;
+	atomic_int go;  // 0 wait, 1 run, -1 abort
+	Path path;
+	// The workers, their open lists and the path
+	Arena arena;
+	Arena *batch_arenas;  // One per worker, MAX_THREADS
+};
+
+// Of the calling thread
+static _Thread_local Hda hda_state;
+
+static inline int owner(const Hda *hda, int x, int y){
+	uint64_t tile = (uint64_t)(y / TILE_SIDE) * hda->tiles_per_row + x / TILE_SIDE;
+	tile ^= tile >> 33;
+	tile *= 0xFF51AFD7ED558CCDULL;
+	tile ^= tile >> 33;
+	return tile % hda->n_threads;
+}
+
+/**
+ * Lowers the g of a node owned by w, and (re)opens it.
+ */
+static void relax(Worker *w, int index, int parent, double g){
+	Hda *hda = w->hda;
+	Node *node = &hda->nodes[index];
+	bool seen = node->stamp == hda->stamp;
+	if (seen && g >= node->g){
+		return;
+	}
+	Node *parent_node = parent < 0 ? NULL : &hda->nodes[parent];
+	if (!seen){
+		node->stamp = hda->stamp;
+		node->coord = (Coordinates){index % n_cols, index / n_cols};
+		node->h = hda->cost_unit * hda->heuristic(node->coord, hda->end);
+		node->heap_index = -1;
+	}
+	node->parent = parent_node;
+	if (node->coord.x == hda->end.x && node->coord.y == hda->end.y){
+		// Only the owner of the goal writes the incumbent
+		node->g = g;
+		atomic_store(&hda->incumbent, g);
+		return;
+	}
+	if (heap_exists(&w->open, node)){
+		heap_change_priority(&w->open, node, g, node->h);
+	}else{
+		node->g = g;
+		heap_add(&w->open, node);
+	}
+}
+
+static void push_batch(Worker *dst, Batch *batch){
+	Hda *hda = dst->hda;
+	atomic_fetch_add(&hda->work, 1);
+	batch->next = atomic_load(&dst->inbox);
+	while (!atomic_compare_exchange_weak(&dst->inbox, &batch->next, batch));
+}
+
+static void flush(Worker *w){
+	Hda *hda = w->hda;
+	for (int t = 0; t < hda->n_threads; t++){
+		if (w->outbox[t]){
+			push_batch(&hda->workers[t], w->outbox[t]);
+			w->outbox[t] = NULL;
+		}
+	}
+}
+
+/**
+ * Relaxes the nodes of every batch received.
+ * Returns the number of batches.
+ */
+static long receive(Worker *w){
+	Batch *batch = atomic_exchange(&w->inbox, NULL);
+	long n = 0;
+	while (batch){
+		for (int i = 0; i < batch->n_messages; i++){
+			Message *m = &batch->messages[i];
+			relax(w, m->node, m->parent, m->g);
+		}
+		Batch *next = batch->next;
+		batch->next = w->free_batches;
+		w->free_batches = batch;
+		batch = next;
+		n++;
+	}
+	return n;
+}
+
+static void send(Worker *w, int dst, Message m){
+	Hda *hda = w->hda;
+	Batch *batch = w->outbox[dst];
+	if (!batch){
+		batch = w->free_batches;
+		if (batch){
+			w->free_batches = batch->next;
+		}else if (!(batch = arena_alloc(w->batches, sizeof(*batch)))){
+			abort();
+		}
+		batch->n_messages = 0;
+		w->outbox[dst] = batch;
+	}
+	batch->messages[batch->n_messages++] = m;
+	if (batch->n_messages == BATCH_SIZE){
+		push_batch(&hda->workers[dst], batch);
+		w->outbox[dst] = NULL;
+	}
+}
+
+static void expand(Worker *w, Node *node){
+	static const int dirs[8][2] = {
+		{-1, 0}, {1, 0}, {0, 1}, {0, -1},
+		{-1, 1}, {-1, -1}, {1, 1}, {1, -1}
+	};
+	Hda *hda = w->hda;
+	int n_dirs = horizontal_movement ? 8 : 4;
+	int parent = node->coord.y * n_cols + node->coord.x;
+	double incumbent = atomic_load_explicit(&hda->incumbent, memory_order_relaxed);
+	for (int d = 0; d < n_dirs; d++){
+		int x = node->coord.x + dirs[d][0];
+		int y = node->coord.y + dirs[d][1];
+		if (x < 0 || x >= n_cols || y < 0 || y >= n_rows || clearance_get(x, y) < hda->needed){
+			continue;
+		}
+		double step = d < 4 ? 1.0 : M_SQRT2;
+		if (!hda->uniform_cost){
+			step *= (cost_get(node->coord.x, node->coord.y) + cost_get(x, y)) * 0.5;
+		}
+		double g = node->g + step;
+		// It can't lead to a better path than the incumbent
+		if (g + hda->cost_unit * hda->heuristic((Coordinates){x, y}, hda->end) >= incumbent){
+			continue;
+		}
+		int dst = owner(hda, x, y);
+		if (dst == w->id){
+			relax(w, y * n_cols + x, parent, g);
+		}else{
+			send(w, dst, (Message){y * n_cols + x, parent, g});
+		}
+	}
+}
+
+static bool has_work(Worker *w){
+	Hda *hda = w->hda;
+	if (w->open.n_elements == 0){
+		return false;
+	}
+	Node *best = heap_peek(&w->open);
+	return best->g + best->h < atomic_load_explicit(&hda->incumbent, memory_order_relaxed);
+}
+
+static void* worker_run(void *arg){
+	Worker *w = arg;
+	Hda *hda = w->hda;
+	grid_view = hda->view;
+	// The first one runs on the calling thread
+	if (w->id > 0){
+		trace_thread_name("hda worker");
+	}
+	while (atomic_load(&hda->go) == 0){
+		sched_yield();
+	}
+	if (atomic_load(&hda->go) < 0){
+		return NULL;
+	}
+	trace_begin("hda_search");
+	bool busy = true;
+	int expansions = 0;
+	for (;;){
+		if (busy){
+			if (atomic_load_explicit(&w->inbox, memory_order_relaxed)){
+				atomic_fetch_sub(&hda->work, receive(w));
+			}
+			if (has_work(w)){
+				Node *node = heap_pop(&w->open);
+				expand(w, node);
+				if (++expansions % FLUSH_INTERVAL == 0){
+					flush(w);
+				}
+				continue;
+			}
+			flush(w);
+			busy = false;
+			atomic_fetch_sub(&hda->work, 1);
+		}
+		if (atomic_load(&w->inbox)){
+			// Counted busy again before the batches stop counting
+			busy = true;
+			atomic_fetch_add(&hda->work, 1);
+			atomic_fetch_sub(&hda->work, receive(w));
+		}else if (atomic_load(&hda->work) == 0){
+			break;
+		}else{
+			sched_yield();
+		}
+	}
+	trace_end();
+	return NULL;
+}
+
+/**
+ * Sets up the nodes, if they weren't, and the workers of a query.
+ * The memory of the previous query is reused.
+ */
+static int init_workers(Hda *hda, int n_threads){
+	if (!hda->batch_arenas){
+		hda->batch_arenas = calloc(MAX_THREADS, sizeof(Arena));
+		if (!hda->batch_arenas){
+			return -1;
+		}
+	}
+	if (!hda->nodes){
+		// Zeroed pages are mapped lazily, so this doesn't touch the whole grid
+		hda->nodes = calloc((size_t)n_rows * n_cols, sizeof(Node));
+		if (!hda->nodes){
+			return -1;
+		}
+	}
+	// Wrapped around, some node may have the new stamp
+	if (++hda->stamp > NODE_STAMP_MAX){
+		memset(hda->nodes, 0, sizeof(Node) * n_rows * n_cols);
+		hda->stamp = 1;
+	}
+	arena_reset(&hda->arena);
+	hda->path = (Path){0};
+	hda->n_threads = n_threads;
+	hda->tiles_per_row = (n_cols + TILE_SIDE - 1) / TILE_SIDE;
+	hda->workers = arena_alloc(&hda->arena, sizeof(Worker) * n_threads);
+	// Every open list is sized to the number of cells its thread owns
+	int *owned = arena_alloc(&hda->arena, sizeof(int) * n_threads);
+	if (!hda->workers || !owned){
+		return -1;
+	}
+	memset(hda->workers, 0, sizeof(Worker) * n_threads);
+	memset(owned, 0, sizeof(int) * n_threads);
+	for (int ty = 0; ty < n_rows; ty += TILE_SIDE){
+		for (int tx = 0; tx < n_cols; tx += TILE_SIDE){
+			int w = tx + TILE_SIDE < n_cols ? TILE_SIDE : n_cols - tx;
+			int h = ty + TILE_SIDE < n_rows ? TILE_SIDE : n_rows - ty;
+			owned[owner(hda, tx, ty)] += w * h;
+		}
+	}
+	for (int t = 0; t < n_threads; t++){
+		Worker *w = &hda->workers[t];
+		w->hda = hda;
+		w->id = t;
+		w->batches = &hda->batch_arenas[t];
+		w->open.elements = arena_alloc(&hda->arena, sizeof(Node*) * (owned[t] + 1));
+		w->outbox = arena_alloc(&hda->arena, sizeof(Batch*) * n_threads);
+		atomic_init(&w->inbox, NULL);
+		if (!w->open.elements || !w->outbox){
+			return -1;
+		}
+		memset(w->outbox, 0, sizeof(Batch*) * n_threads);
+		arena_reset(w->batches);
+	}
+	return 1;
+}
+
+/**
+ * Starts every worker but the first one, which is run by the
+ * calling thread. Returns -1 if some thread can't be started.
+ */
+static int run_workers(Hda *hda){
+	atomic_store(&hda->go, 0);
+	int started = 1;
+	for (; started < hda->n_threads; started++){
+		if (pthread_create(&hda->workers[started].thread, NULL, worker_run, &hda->workers[started]) != 0){
+			break;
+		}
+	}
+	bool ok = started == hda->n_threads;
+	atomic_store(&hda->go, ok ? 1 : -1);
+	if (ok){
+		worker_run(&hda->workers[0]);
+	}
+	for (int t = 1; t < started; t++){
+		pthread_join(hda->workers[t].thread, NULL);
+	}
+	return ok ? 1 : -1;
+}
+
+/**
+ * A* with n_threads threads. The path is optimal, like find_path's,
+ * though it may be a different one of the same cost, since the
+ * turns are not penalized. It's only worth it on long searches
+ * over big grids: the threads are started for every query.
+ * The Path is only valid until the next call on the thread.
+ */
+Path find_path_parallel(Coordinates start, Coordinates end, heuristic_function heuristic, int agent_size, int n_threads){
+	if (!heuristic){
+		heuristic = horizontal_movement ? heuristic_euclidean : heuristic_manhatan;
+	}
+	if (n_threads > MAX_THREADS){
+		n_threads = MAX_THREADS;
+	}
+	if (n_threads <= 1){
+		return find_path(start, end, heuristic, agent_size);
+	}
+	Hda *hda = &hda_state;
+	hda->end = end;
+	hda->heuristic = heuristic;
+	hda->needed = clearance_needed(agent_size);
+	hda->view = grid_view;
+	hda->uniform_cost = cost_uniform();
+	hda->cost_unit = hda->uniform_cost ? 1 : cost_lowest();
+	atomic_store(&hda->incumbent, DBL_MAX);
+	if (init_workers(hda, n_threads) != 1){
+		return find_path(start, end, heuristic, agent_size);
+	}
+
+	int first = start.y * n_cols + start.x;
+	relax(&hda->workers[owner(hda, start.x, start.y)], first, -1, 0.0);
+	atomic_store(&hda->work, n_threads);
+	if (run_workers(hda) != 1){
+		return find_path(start, end, heuristic, agent_size);
+	}
+
+	// Traced like find_path's, and written from start to end
+	int length = 0;
+	Node *goal = &hda->nodes[end.y * n_cols + end.x];
+	bool reached = goal->stamp == hda->stamp;
+	if (!reached){
+		length = 1;
+	}else{
+		for (Node *n = goal; n; n = n->parent){
+			length++;
+		}
+	}
+	hda->path.path = arena_alloc(&hda->arena, sizeof(Coordinates) * length);
+	hda->path.path_length = 0;
+	if (!hda->path.path){
+		return hda->path;
+	}
+	hda->path.path_length = length;
+	if (!reached){
+		hda->path.path[0] = end;
+	}else{
+		for (Node *n = goal; n; n = n->parent){
+			hda->path.path[--length] = n->coord;
+		}
+	}
+	hda->path.bound = 1.0;
+	return hda->path;
+}
+
+/**
+ * Frees the memory of the queries of the calling thread.
+ */
+void parallel_free(void){
+	Hda *hda = &hda_state;
+	free(hda->nodes);
+	hda->nodes = NULL;
+	hda->stamp = 0;
+	arena_free(&hda->arena);
+	if (hda->batch_arenas){
+		for (int t = 0; t < MAX_THREADS; t++){
+			arena_free(&hda->batch_arenas[t]);
+		}
+		free(hda->batch_arenas);
+		hda->batch_arenas = NULL;
+	}
+	hda->path = (Path){0};
+}
@@ -0,0 +1,15 @@
+/**
+ * Parallel search of a single query (HDA*).
+ * Every thread can run its own queries at once, like with find_path,
+ * and parallel_free frees the memory of the calling thread's.
+ */
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include "path_finding.h"
+
+Path find_path_parallel(Coordinates start, Coordinates end, heuristic_function heuristic, int agent_size, int n_threads);
+
+void parallel_free(void);
+
+#endif // PARALLEL_H
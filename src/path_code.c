@@ -0,0 +1,88 @@
+/**
+ * Copies and compact encoding of the paths.
+ * The moves are numbered counterclockwise from east, so a move and
+ * the opposite one are 4 codes apart.
+ */
+#include "path_code.h"
+#include <string.h>
+
+static const int moves[8][2] = {
+	{1, 0}, {1, -1}, {0, -1}, {-1, -1}, {-1, 0}, {-1, 1}, {0, 1}, {1, 1}
+};
+
+// Code of the move (dx, dy), at (dy + 1) * 3 + dx + 1
+static const int8_t codes[9] = {
+	3, 2, 1,
+	4, -1, 0,
+	5, 6, 7
+};
+
+/**
+ * Copies the cells of path to out, from start to end.
+ * Returns -1, without writing anything, if they don't fit.
+ */
+int path_copy(Path path, Coordinates *out, int capacity){
+	if (path.path_length > capacity){
+		return -1;
+	}
+	memcpy(out, path.path, sizeof(Coordinates) * path.path_length);
+	return 1;
+}
+
+/**
+ * Encodes the moves of path in code, which must have room for
+ * path_code_size(path.path_length) bytes. Its start is the first
+ * cell of the path. Returns -1 if they don't fit, or if a move is
+ * not to a neighbour.
+ */
+int path_encode(Path path, uint8_t *code, size_t capacity){
+	size_t size = path_code_size(path.path_length);
+	if (size > capacity){
+		return -1;
+	}
+	memset(code, 0, size);
+	for (int i = 1; i < path.path_length; i++){
+		int dx = path.path[i].x - path.path[i-1].x;
+		int dy = path.path[i].y - path.path[i-1].y;
+		if (dx < -1 || dx > 1 || dy < -1 || dy > 1 || (dx == 0 && dy == 0)){
+			return -1;
+		}
+		unsigned move = codes[(dy + 1) * 3 + dx + 1];
+		size_t bit = (size_t)(i - 1) * PATH_MOVE_BITS;
+		code[bit / 8] |= move << (bit % 8);
+		// A code that starts in the last two bits of a byte spills over
+		if (bit % 8 > 8 - PATH_MOVE_BITS){
+			code[bit / 8 + 1] |= move >> (8 - bit % 8);
+		}
+	}
+	return 1;
+}
+
+/**
+ * Writes to out the length cells of the path encoded in code,
+ * from start. Returns -1, without writing anything, if they
+ * don't fit.
+ */
+int path_decode(Coordinates start, const uint8_t *code, int length, Coordinates *out, int capacity){
+	if (length > capacity){
+		return -1;
+	}
+	if (length <= 0){
+		return 1;
+	}
+	size_t size = path_code_size(length);
+	Coordinates c = start;
+	out[0] = c;
+	for (int i = 1; i < length; i++){
+		size_t bit = (size_t)(i - 1) * PATH_MOVE_BITS;
+		unsigned word = code[bit / 8];
+		if (bit / 8 + 1 < size){
+			word |= (unsigned)code[bit / 8 + 1] << 8;
+		}
+		int move = (word >> (bit % 8)) & ((1 << PATH_MOVE_BITS) - 1);
+		c.x += moves[move][0];
+		c.y += moves[move][1];
+		out[i] = c;
+	}
+	return 1;
+}
@@ -0,0 +1,28 @@
+/**
+ * Copies of the paths in buffers owned by the caller, which outlive
+ * the next search, either as cells or in a compact encoding.
+ *
+ * The encoding is the start cell and a code of PATH_MOVE_BITS bits per
+ * move, packed from the lowest bit of the first byte up, so a path of
+ * n cells takes path_code_size(n) bytes besides its start, instead of
+ * sizeof(Coordinates) per cell. Only paths of moves to one of the 8
+ * neighbours can be encoded, not the any angle ones.
+ */
+#ifndef PATH_CODE_H
+#define PATH_CODE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "path_finding.h"
+
+#define PATH_MOVE_BITS 3
+
+static inline size_t path_code_size(int length){
+	return length > 1 ? ((size_t)(length - 1) * PATH_MOVE_BITS + 7) / 8 : 0;
+}
+
+int path_copy(Path path, Coordinates *out, int capacity);
+int path_encode(Path path, uint8_t *code, size_t capacity);
+int path_decode(Coordinates start, const uint8_t *code, int length, Coordinates *out, int capacity);
+
+#endif // PATH_CODE_H
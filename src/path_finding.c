@@ -5,104 +5,265 @@
 #include "heap.h"
 #include "args.h"
 #include "path_finding.h"
+#include "grid.h"
+#include "clearance.h"
+#include "cost.h"
+#include "parallel.h"
+#include "cooperative.h"
+#include "cpd.h"
+#include "subgoal.h"
+#include "generator.h"
+#include "arena.h"
+#include "trace.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
 #include <time.h>
+#include <float.h>
+#include <string.h>
 
-static Node *matrix;
-#define matrix(i,j) matrix[(i) * n_cols + (j)]
+/*
+ * The search state is kept per thread, so several threads can
+ * search the same grid at once. The main thread's is set up by
+ * path_finding_init, any other thread must call
+ * path_finding_thread_init before searching.
+ */
+static _Thread_local Node *matrix;
+#define matrix(i,j) matrix[node_index(j, i)]
 extern int n_rows;
 extern int n_cols;
-Heap open;
-static Path path;
+
+/*
+ * Layout of the matrix, set up by path_finding_init. The blocked
+ * and Morton layouts pad the grid to whole blocks, and count them
+ * row after row, so a block is block_cols cells wide.
+ */
+node_layout layout = LAYOUT_ROWS;
+#define BLOCK_BITS 3
+#define TILE_BITS 6
+static int block_cols;
+static size_t matrix_cells;
+// Bits of 0..63 spread to the even positions
+static uint16_t morton_spread[1 << TILE_BITS];
+
+static inline long node_index(int x, int y){
+	switch (layout){
+	case LAYOUT_BLOCKED: {
+		const int mask = (1 << BLOCK_BITS) - 1;
+		long block = (long)(y >> BLOCK_BITS) * block_cols + (x >> BLOCK_BITS);
+		return block << (2 * BLOCK_BITS) | (y & mask) << BLOCK_BITS | (x & mask);
+	}
+	case LAYOUT_MORTON: {
+		const int mask = (1 << TILE_BITS) - 1;
+		long tile = (long)(y >> TILE_BITS) * block_cols + (x >> TILE_BITS);
+		return tile << (2 * TILE_BITS) | morton_spread[x & mask] | morton_spread[y & mask] << 1;
+	}
+	default:
+		return (long)y * n_cols + x;
+	}
+}
+
+int layout_parse(const char *name, node_layout *out){
+	if (strcmp(name, "rows") == 0){
+		*out = LAYOUT_ROWS;
+	}else if (strcmp(name, "blocked") == 0){
+		*out = LAYOUT_BLOCKED;
+	}else if (strcmp(name, "morton") == 0){
+		*out = LAYOUT_MORTON;
+	}else{
+		return -1;
+	}
+	return 1;
+}
+
+/**
+ * Sets up the geometry of the layout for the current grid.
+ */
+static void layout_init(void){
+	int bits = layout == LAYOUT_BLOCKED ? BLOCK_BITS : layout == LAYOUT_MORTON ? TILE_BITS : 0;
+	int side = 1 << bits;
+	block_cols = (n_cols + side - 1) >> bits;
+	matrix_cells = (size_t)block_cols * ((n_rows + side - 1) >> bits) << (2 * bits);
+	for (int i = 0; i < 1 << TILE_BITS; i++){
+		morton_spread[i] = 0;
+		for (int b = 0; b < TILE_BITS; b++){
+			morton_spread[i] |= ((i >> b) & 1) << (2 * b);
+		}
+	}
+}
+// Nodes with another stamp are not part of the current search
+static _Thread_local unsigned stamp;
+// Everything else comes from here, and is freed by reset_search
+static _Thread_local Arena scratch;
+static _Thread_local Heap open;
+static _Thread_local int open_capacity;
+static _Thread_local Path path;
+static _Thread_local int path_capacity;
+// Nodes whose g improved after being closed during an
+// anytime iteration. They are reopened on the next one.
+static _Thread_local Node **incons;
+static _Thread_local int n_incons;
+static _Thread_local int incons_capacity;
+// Nodes closed during an anytime iteration, to open them again
+static _Thread_local Node **closed;
+static _Thread_local int n_closed;
+static _Thread_local int closed_capacity;
+static _Thread_local bool track_closed;
+// Whether the current search ignores the costs, since they are all
+// the same, and the lowest one, by which the heuristics are scaled
+static _Thread_local bool uniform_cost;
+static _Thread_local int cost_unit;
 
 // Defined in main.c, determines if the
 // steps of the search must be rendered
 extern bool animate_search;
 bool horizontal_movement = true;
-bool break_search;
+static _Thread_local bool break_search;
 void take_step();
 
 #define abs(n) ((n) < 0 ? -(n) : (n))
 
 /**
- * Adds the node's neighbours to it's adjacency array.
+ * Returns the node of the cell (x, y), set up for the current
+ * search if it's the first time the search gets to it.
+ */
+static inline Node* node_at(int x, int y){
+	Node *node = &matrix(y, x);
+	if (node->stamp != stamp){
+		*node = (Node){.coord = {x, y}, .heap_index = -1, .stamp = stamp};
+	}
+	return node;
+}
+
+/**
+ * Grows array, which has *capacity elements of the given size, to
+ * fit n of them. It grows geometrically, in the scratch arena.
+ * Returns the grown array, or NULL if it can't.
  */
-static void get_children(Node *node, int x, int y){
+static void* grow_array(void *array, int *capacity, int n, size_t size){
+	int new_capacity = *capacity > 0 ? *capacity : 256;
+	while (new_capacity < n){
+		new_capacity *= 2;
+	}
+	void *grown = arena_grow(&scratch, array, (size_t)*capacity * size, (size_t)new_capacity * size);
+	if (grown){
+		*capacity = new_capacity;
+	}
+	return grown;
+}
+
+static inline bool reserve_nodes(Node ***array, int *capacity, int n){
+	if (n <= *capacity){
+		return true;
+	}
+	Node **grown = grow_array(*array, capacity, n, sizeof(Node*));
+	if (grown){
+		*array = grown;
+	}
+	return grown;
+}
+
+static inline bool reserve_coords(Coordinates **array, int *capacity, int n){
+	if (n <= *capacity){
+		return true;
+	}
+	Coordinates *grown = grow_array(*array, capacity, n, sizeof(Coordinates));
+	if (grown){
+		*array = grown;
+	}
+	return grown;
+}
+
+/**
+ * Stores the neighbours of the cell c in adj, and returns how many.
+ * They are computed on every expansion instead of being kept in the
+ * nodes, so the matrix needs no initialization per cell.
+ * Only valid during a search, the nodes are set up for it.
+ */
+int get_children(Coordinates c, Node **adj){
+	int x = c.x;
+	int y = c.y;
 	int n_adj = 0;
-	Node **adj = node->adjacency;
 	if (x - 1 >= 0){
-		adj[n_adj++] = &matrix(y, x-1);
+		adj[n_adj++] = node_at(x-1, y);
 	}
 	if (x + 1 < n_cols){
-		adj[n_adj++] = &matrix(y,(x+1));
+		adj[n_adj++] = node_at(x+1, y);
 	}
 	if (y + 1 < n_rows){
-		adj[n_adj++] = &matrix(y+1,x);
+		adj[n_adj++] = node_at(x, y+1);
 	}
 	if (y - 1 >= 0){
-		adj[n_adj++] = &matrix((y-1) ,x);
+		adj[n_adj++] = node_at(x, y-1);
 	}
 	if (horizontal_movement){
 		if (x - 1 >= 0){
 			if (y + 1 < n_rows){
-				adj[n_adj++] = &matrix(y+1, x-1);
+				adj[n_adj++] = node_at(x-1, y+1);
 			}
 			if (y - 1 >= 0){
-				adj[n_adj++] = &matrix(y-1,x-1);
+				adj[n_adj++] = node_at(x-1, y-1);
 			}
 
 		}
 		if (x + 1 < n_cols){
 			if (y + 1 < n_rows){
-				adj[n_adj++] = &matrix(y+1,x+1);
+				adj[n_adj++] = node_at(x+1, y+1);
 			}
 			if (y - 1 >= 0){
-				adj[n_adj++] = &matrix(y-1,x+1);
+				adj[n_adj++] = node_at(x+1, y-1);
 			}
 		}
 	}
-	node->n_adjacencies = n_adj;
+	return n_adj;
 }
 
 /**
- * Initializes the matrix and the helper structures.
+ * Initializes the grid, and the search state of the calling thread.
  */
 int path_finding_init(){
-	matrix = malloc(n_rows * n_cols * sizeof(*matrix));
-	if (!matrix){
-		return -1;
-	}
-	for (int i = 0; i < n_rows; i++){
-		for (int j = 0; j < n_cols; j++){
-			matrix(i ,j).parent = NULL;
-			matrix(i ,j).barrier = false;
-			matrix(i ,j).coord = (Coordinates) {.x = j, .y = i};
-			get_children(&matrix(i ,j), j, i);
-		}
-	}
-	open = (Heap){
-		.n_elements = 0,
-		.elements = malloc(sizeof(Node*) * n_rows * n_cols)
-	};
-	if (!open.elements){
+	if (grid_init() != 1 || clearance_init() != 1 || cost_init() != 1){
 		return -1;
 	}
-	path = (Path){
-		.path_length = 0,
-		.path = malloc(sizeof(Coordinates) * n_rows * n_cols)
-	};
-	if (!path.path){
+	layout_init();
+	return path_finding_thread_init();
+}
+
+void path_finding_free(){
+	path_finding_thread_free();
+	cpd_free();
+	subgoal_free();
+	grid_free();
+}
+
+/**
+ * Initializes the matrix of the calling thread. The nodes are left
+ * zeroed, they are set up when a search first gets to them, so
+ * neither the startup nor a search costs the size of the grid.
+ * The rest of the search state grows in the scratch arena as needed.
+ */
+int path_finding_thread_init(){
+	matrix = calloc(matrix_cells, sizeof(*matrix));
+	if (!matrix){
 		return -1;
 	}
+	stamp = 0;
 	return 1;
 }
 
-void path_finding_free(){
+void path_finding_thread_free(){
 	free(matrix);
-	free(open.elements);
-	free(path.path);
+	arena_free(&scratch);
+	cooperative_free();
+	cpd_thread_free();
+	subgoal_thread_free();
+	parallel_free();
+	matrix = NULL;
+	open = (Heap){0};
+	path = (Path){0};
+	incons = NULL;
+	closed = NULL;
+	open_capacity = path_capacity = incons_capacity = closed_capacity = 0;
 }
 
 static inline double distance(Coordinates c1, Coordinates c2){
@@ -114,45 +275,93 @@ static inline double distance(Coordinates c1, Coordinates c2){
 }
 
 /**
- * Performs the A* path finding algorithm between the nodes
- * start and end.
- * It returns a Path structure, with an array of coordinates.
+ * Cost of the move between the neighbours c1 and c2:
+ * its length, times the mean cost of both cells.
  */
-Path find_path(Coordinates start, Coordinates end, heuristic_function heuristic){
-	if (!heuristic){
-		if (horizontal_movement){
-			heuristic = heuristic_euclidean;
-		}else{
-			heuristic = heuristic_manhatan;
-		}
+static inline double step_cost(Coordinates c1, Coordinates c2){
+	if (uniform_cost){
+		return distance(c1, c2);
 	}
+	return distance(c1, c2) * (cost_get(c1.x, c1.y) + cost_get(c2.x, c2.y)) * 0.5;
+}
+
+/**
+ * The heuristic from c to end, scaled to the costs of the cells.
+ */
+static inline double estimate(heuristic_function heuristic, Coordinates c, Coordinates end){
+	return cost_unit * heuristic(c, end);
+}
+
+/**
+ * Starts a new search. The nodes of the previous one are left
+ * behind by changing the stamp, and its scratch memory is freed,
+ * so the previous Path is no longer valid.
+ */
+static void reset_search(){
+	trace_begin("reset_search");
 	break_search = false;
-	for (int i = 0; i < n_rows; i++){
-		for (int j = 0; j < n_cols; j++){
-			matrix(i ,j).parent = NULL;
-			matrix(i ,j).visited = false;
-			matrix(i ,j).closed = false;
-			matrix(i ,j).heap_index = -1;
-		}
+	// Wrapped around, some node may have the new stamp
+	if (++stamp > NODE_STAMP_MAX){
+		memset(matrix, 0, sizeof(*matrix) * matrix_cells);
+		stamp = 1;
 	}
-	open.n_elements = 0;
+	arena_reset(&scratch);
+	open = (Heap){0};
+	path = (Path){0};
+	incons = NULL;
+	closed = NULL;
+	n_incons = n_closed = 0;
+	open_capacity = path_capacity = incons_capacity = closed_capacity = 0;
+	track_closed = false;
+	uniform_cost = cost_uniform();
+	cost_unit = uniform_cost ? 1 : cost_lowest();
+	trace_end();
+}
 
-	// Put the start node in the heap
-	Node *start_node = &matrix(start.y ,start.x);
-	start_node->g = 0.0;
-	start_node->h = 0.0;
-	heap_add(&open, start_node);
+static double now_ms(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
 
+/**
+ * Runs the A* main loop over the nodes already in the open list,
+ * until the node at end is popped or the open list runs out.
+ * The heuristic is inflated by weight. If anytime is set, closed
+ * nodes are not reopened, but stored in the incons list instead,
+ * and the search gives up once deadline (in ms) is reached.
+ * Only the cells with at least the given clearance are entered.
+ */
+static void search(Coordinates end, heuristic_function heuristic,
+		   double weight, bool anytime, double deadline, int needed){
 	Coordinates prev_coord = {0};
+	int steps = 0;
+	const GridVersion *view = grid_view;
+	trace_begin("search");
 
 	while (open.n_elements > 0 && !break_search){
+		// Room for every child, and for current in the closed list
+		if (!reserve_nodes(&open.elements, &open_capacity, open.n_elements + 8)
+		    || (track_closed && !reserve_nodes(&closed, &closed_capacity, n_closed + 1))
+		    || (anytime && !reserve_nodes(&incons, &incons_capacity, n_incons + 8))){
+			break_search = true;
+			break;
+		}
 		Node *current = heap_pop(&open);
 		if (current->coord.x == end.x && current->coord.y == end.y){
 			break;
 		}
 
+		// Checking the clock on every expansion would be too expensive
+		if (anytime && (++steps & 255) == 0 && now_ms() >= deadline){
+			break_search = true;
+		}
+
 		current->visited = true;
 		current->closed = true;
+		if (track_closed){
+			closed[n_closed++] = current;
+		}
 
 		if (animate_search){
 			take_step();
@@ -163,14 +372,16 @@ Path find_path(Coordinates start, Coordinates end, heuristic_function heuristic)
 			.y = current->coord.y - prev_coord.y
 		};
 
-		for (int i = 0; i < current->n_adjacencies; ++i){
-			Node *child = current->adjacency[i];
-			if (child->barrier){
+		Node *children[8];
+		int n_children = get_children(current->coord, children);
+		for (int i = 0; i < n_children; ++i){
+			Node *child = children[i];
+			if (clearance_in(view, child->coord.x, child->coord.y) < needed){
 				continue;
 			}
 
-			double g = current->g + distance(current->coord, child->coord);
-			double h = heuristic(child->coord, end);
+			double g = current->g + step_cost(current->coord, child->coord);
+			double h = weight * estimate(heuristic, child->coord, end);
 
 			Coordinates diff2 = {
 				.x = child->coord.x - current->coord.x,
@@ -186,13 +397,24 @@ Path find_path(Coordinates start, Coordinates end, heuristic_function heuristic)
 			if (child->closed){
 				if (g >= child->g){
 					continue;
+				}else if (anytime){
+					child->g = g;
+					child->h = h;
+					child->parent = current;
+					if (!child->incons){
+						child->incons = true;
+						incons[n_incons++] = child;
+					}
+					continue;
 				}else{
 					child->closed = false;
 				}
 			}
 
+			// Nodes expanded on a previous anytime iteration
+			// keep their g, even if they are not closed anymore
 			bool exists = heap_exists(&open, child);
-			if (!exists || g < child->g){
+			if ((!exists && !child->visited) || g < child->g){
 				if (exists){
 					heap_change_priority(&open, child, g, h);
 				}else{
@@ -205,27 +427,434 @@ Path find_path(Coordinates start, Coordinates end, heuristic_function heuristic)
 		}
 		prev_coord = current->coord;
 	}
-	// Trace back the path
+	trace_end();
+}
+
+static heuristic_function default_heuristic(heuristic_function heuristic){
+	if (heuristic){
+		return heuristic;
+	}
+	return horizontal_movement ? heuristic_euclidean : heuristic_manhatan;
+}
+
+static void trace_path(Coordinates end){
 	path.path_length = 0;
-	Node *n = &matrix(end.y ,end.x);
-	do{
+	Node *goal = node_at(end.x, end.y);
+	int length = 0;
+	for (Node *n = goal; n; n = n->parent){
+		length++;
+	}
+	if (!reserve_coords(&path.path, &path_capacity, length)){
+		return;
+	}
+	path.path_length = length;
+	for (Node *n = goal; n; n = n->parent){
+		path.path[--length] = n->coord;
+	}
+}
+
+/**
+ * Performs the A* path finding algorithm between the nodes
+ * start and end, for an agent that is agent_size cells wide.
+ * It returns a Path structure, with the coordinates from start
+ * to end, or only end if there's no path. It's only valid until
+ * the next search of the thread, path_copy and path_encode keep it.
+ */
+Path find_path(Coordinates start, Coordinates end, heuristic_function heuristic, int agent_size){
+	return find_path_weighted(start, end, heuristic, 1.0, agent_size);
+}
+
+/**
+ * Weighted A*. The heuristic is inflated by weight (>= 1), which
+ * usually expands far less nodes. The path found costs at most
+ * weight times the optimal one, and that bound is set in the Path.
+ */
+Path find_path_weighted(Coordinates start, Coordinates end, heuristic_function heuristic, double weight, int agent_size){
+	heuristic = default_heuristic(heuristic);
+	if (weight < 1.0){
+		weight = 1.0;
+	}
+	reset_search();
+
+	// Put the start node in the heap
+	Node *start_node = node_at(start.x, start.y);
+	start_node->g = 0.0;
+	start_node->h = 0.0;
+	if (!reserve_nodes(&open.elements, &open_capacity, 1)){
+		return path;
+	}
+	heap_add(&open, start_node);
+
+	search(end, heuristic, weight, false, 0, clearance_needed(agent_size));
+
+	// Trace back the path
+	trace_path(end);
+	path.bound = weight;
+
+	return path;
+}
+
+/**
+ * Moves the incons list into the open list, and recomputes the
+ * priorities of the open nodes with the new weight.
+ * Closed nodes are opened again for the next iteration.
+ */
+static bool prepare_iteration(Coordinates end, heuristic_function heuristic, double weight){
+	if (!reserve_nodes(&open.elements, &open_capacity, open.n_elements + n_incons)){
+		return false;
+	}
+	for (int i = 0; i < n_incons; i++){
+		incons[i]->incons = false;
+		if (!heap_exists(&open, incons[i])){
+			open.elements[open.n_elements++] = incons[i];
+		}
+	}
+	n_incons = 0;
+
+	int n = open.n_elements;
+	open.n_elements = 0;
+	for (int i = 0; i < n; i++){
+		Node *node = open.elements[i];
+		node->h = weight * estimate(heuristic, node->coord, end);
+		heap_add(&open, node);
+	}
+
+	for (int i = 0; i < n_closed; i++){
+		closed[i]->closed = false;
+	}
+	n_closed = 0;
+	return true;
+}
+
+/**
+ * Computes the suboptimality bound of the current solution:
+ * its cost divided by the lowest unweighted f among the nodes
+ * that could still improve it.
+ */
+static double solution_bound(Node *goal, Coordinates end, heuristic_function heuristic, double weight){
+	double min_f = DBL_MAX;
+	for (int i = 0; i < open.n_elements; i++){
+		Node *node = open.elements[i];
+		double f = node->g + estimate(heuristic, node->coord, end);
+		if (f < min_f){
+			min_f = f;
+		}
+	}
+	for (int i = 0; i < n_incons; i++){
+		double f = incons[i]->g + estimate(heuristic, incons[i]->coord, end);
+		if (f < min_f){
+			min_f = f;
+		}
+	}
+	if (min_f <= 0 || goal->g / min_f > weight){
+		return weight;
+	}
+	return goal->g / min_f < 1.0 ? 1.0 : goal->g / min_f;
+}
+
+/**
+ * Anytime Repairing A* (ARA*).
+ * Runs weighted A* with the given weight, and then keeps lowering
+ * it and improving the path while there is time left of the budget
+ * (in ms). Each iteration reuses the search state of the previous
+ * one, so only the nodes that can improve the path are expanded.
+ * The first path is always waited for, the budget only cuts the
+ * improvements. The Path's bound is the one of the last path found.
+ */
+Path find_path_anytime(Coordinates start, Coordinates end, heuristic_function heuristic, double weight, int time_budget, int agent_size){
+	heuristic = default_heuristic(heuristic);
+	int needed = clearance_needed(agent_size);
+	if (weight < 1.0){
+		weight = 1.0;
+	}
+	double deadline = now_ms() + time_budget;
+	reset_search();
+
+	Node *start_node = node_at(start.x, start.y);
+	Node *goal = node_at(end.x, end.y);
+	start_node->g = 0.0;
+	start_node->h = 0.0;
+	if (!reserve_nodes(&open.elements, &open_capacity, 2)){
+		return path;
+	}
+	heap_add(&open, start_node);
+
+	track_closed = true;
+	search(end, heuristic, weight, false, 0, needed);
+	trace_path(end);
+	path.bound = solution_bound(goal, end, heuristic, weight);
+
+	bool reached = goal->parent || goal == start_node;
+	while (reached && path.bound > 1.0 && !break_search && now_ms() < deadline){
+		weight -= 0.5;
+		if (weight < 1.0){
+			weight = 1.0;
+		}
+		// The goal was popped, but must stay in the open list
+		// so it's kept up to date in the next iteration
+		if (!heap_exists(&open, goal)){
+			heap_add(&open, goal);
+		}
+		if (!prepare_iteration(end, heuristic, weight)){
+			break;
+		}
+
+		search(end, heuristic, weight, true, deadline, needed);
+		if (break_search){
+			// The iteration was cut, the last path is kept
+			break;
+		}
+		trace_path(end);
+		path.bound = solution_bound(goal, end, heuristic, weight);
+	}
+
+	return path;
+}
+
+/**
+ * Finds the path from start to the closest reachable coordinate
+ * in goals, in a single search.
+ * Since moves cost the same both ways, the search runs backwards: every goal
+ * is seeded in the open list with g = 0 and the search targets start.
+ * That way the heuristic is a single estimate towards start, and its
+ * cost doesn't depend on the number of goals.
+ * The returned path goes from start to the reached goal, its last
+ * cell, like find_path's. If no goal is reachable, it only contains start.
+ */
+Path find_path_nearest(Coordinates start, const Coordinates *goals, int n_goals, heuristic_function heuristic, int agent_size){
+	heuristic = default_heuristic(heuristic);
+	int needed = clearance_needed(agent_size);
+	reset_search();
+	if (!reserve_nodes(&open.elements, &open_capacity, n_goals)){
+		return path;
+	}
+
+	for (int i = 0; i < n_goals; i++){
+		Coordinates goal = goals[i];
+		if (goal.x < 0 || goal.x >= n_cols || goal.y < 0 || goal.y >= n_rows){
+			continue;
+		}
+		Node *goal_node = node_at(goal.x, goal.y);
+		if (clearance_get(goal.x, goal.y) < needed || heap_exists(&open, goal_node)){
+			continue;
+		}
+		goal_node->g = 0.0;
+		goal_node->h = estimate(heuristic, goal, start);
+		heap_add(&open, goal_node);
+	}
+
+	search(start, heuristic, 1.0, false, 0, needed);
+
+	// The parents lead from start to the goal
+	Node *start_node = node_at(start.x, start.y);
+	int length = 0;
+	for (Node *n = start_node; n; n = n->parent){
+		length++;
+	}
+	if (!reserve_coords(&path.path, &path_capacity, length)){
+		return path;
+	}
+	for (Node *n = start_node; n; n = n->parent){
 		path.path[path.path_length++] = n->coord;
-		n = n->parent;
-	}while(n);
+	}
+	path.bound = 1.0;
+
+	return path;
+}
+
+/**
+ * Whether the cells [x0, x1] of the row y have the given clearance.
+ * Single cell agents only need them free, which is checked a word at
+ * a time on the barrier bitmap.
+ */
+static inline bool span_clear(int y, int x0, int x1, int needed){
+	if (needed <= 1){
+		return !grid_any(y, x0, x1 + 1);
+	}
+	for (int x = x0; x <= x1; x++){
+		if (clearance_get(x, y) < needed){
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+ * Whether the segment between the centers of the cells a and b only
+ * goes through cells with the given clearance. It may touch the corners
+ * of other cells, like diagonal moves do. The cells it goes through in
+ * a row are a single span, so it's checked a row at a time instead of
+ * a cell at a time. The ends of the spans are computed exactly, with
+ * the coordinates doubled to keep the centers integer.
+ */
+static bool line_of_sight(Coordinates a, Coordinates b, int needed){
+	if (a.y > b.y){
+		Coordinates tmp = a;
+		a = b;
+		b = tmp;
+	}
+	int dx = b.x - a.x;
+	int dy = b.y - a.y;
+	if (dy == 0){
+		return dx < 0 ? span_clear(a.y, b.x, a.x, needed) : span_clear(a.y, a.x, b.x, needed);
+	}
+	// Doubled x of the segment at the doubled y, times 2 * dy
+	long d = 2L * dy;
+	long base = (2L * a.x + 1) * dy;
+	for (int y = a.y; y <= b.y; y++){
+		long y0 = y == a.y ? 2L * a.y + 1 : 2L * y;
+		long y1 = y == b.y ? 2L * b.y + 1 : 2L * y + 2;
+		long n0 = base + dx * (y0 - 2L * a.y - 1);
+		long n1 = base + dx * (y1 - 2L * a.y - 1);
+		long lo = n0 < n1 ? n0 : n1;
+		long hi = n0 < n1 ? n1 : n0;
+		// Cells whose inside the segment crosses
+		int x0 = lo / d;
+		int x1 = lo == hi ? x0 : (hi - 1) / d;
+		if (!span_clear(y, x0, x1, needed)){
+			return false;
+		}
+	}
+	return true;
+}
+
+static inline double euclidean(Coordinates a, Coordinates b){
+	return sqrt((double)(b.x - a.x) * (b.x - a.x) + (double)(b.y - a.y) * (b.y - a.y));
+}
+
+/**
+ * Makes the best closed neighbour of node its parent. There's always
+ * one, the node that opened it.
+ */
+static void set_grid_parent(Node *node, int needed){
+	Node *children[8];
+	int n_children = get_children(node->coord, children);
+	node->g = DBL_MAX;
+	for (int i = 0; i < n_children; i++){
+		Node *n = children[i];
+		if (!n->closed || clearance_get(n->coord.x, n->coord.y) < needed){
+			continue;
+		}
+		double g = n->g + distance(n->coord, node->coord);
+		if (g < node->g){
+			node->g = g;
+			node->parent = n;
+		}
+	}
+}
+
+/**
+ * Any angle path from start to end (Lazy Theta*). Every node takes
+ * the parent of the one that opens it, as if it could see it, so the
+ * path goes straight between any two cells that see each other. That
+ * is only checked when the node is expanded, and if they don't, the
+ * node falls back to its best neighbour, like A* would.
+ * The path only holds the ends of its segments, from start to end,
+ * and its cost is the length of the segments. The heuristic is the
+ * euclidean distance, the only admissible one for any angle moves,
+ * inflated by weight. It needs diagonal moves and cells that all cost
+ * the same, otherwise the path is found by find_path_weighted.
+ * The path is usually shorter than the best one of 8-connected moves,
+ * but not always: a few come out some percent longer. So the bound
+ * only accounts for the weight.
+ */
+Path find_path_theta(Coordinates start, Coordinates end, double weight, int agent_size){
+	if (!horizontal_movement || !cost_uniform()){
+		return find_path_weighted(start, end, NULL, weight, agent_size);
+	}
+	if (weight < 1.0){
+		weight = 1.0;
+	}
+	int needed = clearance_needed(agent_size);
+	reset_search();
+
+	Node *start_node = node_at(start.x, start.y);
+	start_node->g = 0.0;
+	start_node->h = 0.0;
+	if (!reserve_nodes(&open.elements, &open_capacity, 1)){
+		return path;
+	}
+	heap_add(&open, start_node);
+
+	trace_begin("search");
+	while (open.n_elements > 0 && !break_search){
+		if (!reserve_nodes(&open.elements, &open_capacity, open.n_elements + 8)){
+			break;
+		}
+		Node *current = heap_pop(&open);
+		current->visited = true;
+		current->closed = true;
+		if (current->parent && !line_of_sight(current->parent->coord, current->coord, needed)){
+			set_grid_parent(current, needed);
+		}
+		if (current->coord.x == end.x && current->coord.y == end.y){
+			break;
+		}
 
+		if (animate_search){
+			take_step();
+		}
+
+		// The children are opened from the parent, the start has none
+		Node *from = current->parent ? current->parent : current;
+		Node *children[8];
+		int n_children = get_children(current->coord, children);
+		for (int i = 0; i < n_children; i++){
+			Node *child = children[i];
+			if (child->closed || clearance_get(child->coord.x, child->coord.y) < needed){
+				continue;
+			}
+			double g = from->g + euclidean(from->coord, child->coord);
+			if (heap_exists(&open, child)){
+				if (g < child->g){
+					heap_change_priority(&open, child, g, child->h);
+					child->parent = from;
+				}
+			}else{
+				child->g = g;
+				child->h = weight * euclidean(child->coord, end);
+				child->parent = from;
+				heap_add(&open, child);
+			}
+		}
+	}
+	trace_end();
+
+	trace_path(end);
+	path.bound = weight;
 	return path;
 }
 
+/**
+ * Finds the path with the search chosen in the command line,
+ * like the GUI does.
+ */
+Path find_path_selected(Coordinates start, Coordinates end){
+	if (any_angle){
+		return find_path_theta(start, end, weight, agent_size);
+	}else if (time_budget > 0){
+		return find_path_anytime(start, end, heuristic, weight, time_budget, agent_size);
+	}else if (subgoal_ready() && weight == 1.0 && agent_size == 1){
+		return find_path_subgoal(start, end);
+	}else if (search_threads > 1 && weight == 1.0){
+		return find_path_parallel(start, end, heuristic, agent_size, search_threads);
+	}
+	return find_path_weighted(start, end, heuristic, weight, agent_size);
+}
+
 bool get_visited(Coordinates c){
-	return matrix(c.y ,c.x).visited;
+	Node *node = &matrix(c.y, c.x);
+	return node->stamp == stamp && node->visited;
 }
 
 void put_barrier(Coordinates c){
-	matrix(c.y, c.x).barrier = !matrix(c.y, c.x).barrier;
+	grid_set(c.x, c.y, !grid_get(c.x, c.y));
+	clearance_update(c.x, c.y);
+	subgoal_update(c.x, c.y);
 }
 
 bool get_barrier(Coordinates c){
-	return matrix(c.y ,c.x).barrier;
+	return grid_get(c.x, c.y);
 }
 
 /**
@@ -234,49 +863,44 @@ bool get_barrier(Coordinates c){
  * which are the two points of the grid.
  */
 void prepare_maze(Coordinates pa, Coordinates pb){
-	for (int i = 0; i < n_rows; ++i){
-		for (int j = 0; j < n_cols; ++j){
-			if ((j != pa.x || i != pa.y) && (j != pb.x || i != pb.y)){
-				matrix(i ,j).barrier = true;
-			}
-		}
-	}
+	grid_fill(true);
+	grid_set(pa.x, pa.y, false);
+	grid_set(pb.x, pb.y, false);
+	clearance_build();
+	subgoal_build();
 }
 
-void random_barriers(Coordinates pa, Coordinates pb){
-	srand(time(NULL));
-	for (int i = 0; i < n_rows; ++i){
-		for (int j = 0; j < n_cols; ++j){
-			if ((j != pa.x || i != pa.y) && (j != pb.x || i != pb.y)){
-				int r = rand() % 100;
-				if (r >= 60){
-					matrix(i ,j).barrier = true;
-				}else{
-					matrix(i ,j).barrier = false;
-				}
-			}
-		}
+/**
+ * Fills the grid with random barriers, except pa and pb.
+ * Each call uses the next seed of the generator, so the
+ * sequence of grids is the same for the same --seed.
+ * Returns -1, leaving the grid as it was, if it can't.
+ */
+int random_barriers(Coordinates pa, Coordinates pb){
+	if (generate_map(GEN_UNIFORM, generator_next_seed(), RANDOM_BARRIERS_DENSITY, generator_threads) != 1){
+		return -1;
 	}
+	grid_set(pa.x, pa.y, false);
+	clearance_update(pa.x, pa.y);
+	subgoal_update(pa.x, pa.y);
+	grid_set(pb.x, pb.y, false);
+	clearance_update(pb.x, pb.y);
+	subgoal_update(pb.x, pb.y);
+	return 1;
 }
 
 /**
- * Clears all the barriers of the grid.
+ * Clears all the barriers of the grid, and its costs.
  */
 void clear_barriers(){
-	for (int i = 0; i < n_rows; ++i){
-		for (int j = 0; j < n_cols; ++j){
-			matrix(i ,j).barrier = false;
-		}
-	}
+	grid_fill(false);
+	cost_fill(COST_DEFAULT);
+	clearance_build();
+	subgoal_build();
 }
 
 void switch_horizontal_movement(){
 	horizontal_movement = !horizontal_movement;
-	for (int i = 0; i < n_rows; i++){
-		for (int j = 0; j < n_cols; j++){
-			get_children(&matrix(i ,j), j, i);
-		}
-	}
 }
 
 void set_break_search(){
@@ -14,25 +14,50 @@
 typedef struct Path {
         Coordinates *path;
         int path_length;
+        // The path costs at most bound times the optimal one
+        double bound;
 } Path;
 
+#define NODE_STAMP_BITS 29
+#define NODE_STAMP_MAX ((1u << NODE_STAMP_BITS) - 1)
+
 typedef struct Node{
 	struct Node *parent;
 	Coordinates coord;
-	bool barrier;
-	bool visited;
-	bool closed;
+	bool visited : 1;
+	bool closed : 1;
+	bool incons : 1;
+	// Of the search that set it up, for the searches that reuse
+	// nodes. It shares a word with the flags, to keep nodes small.
+	unsigned stamp : NODE_STAMP_BITS;
 
 	int heap_index;
 
 	double g;
 	double h;
-	struct Node *adjacency[8];
-	int n_adjacencies;
 } Node;
 
+/*
+ * Order of the nodes in memory, chosen before path_finding_init.
+ * Row-major puts the cells above and below another one a whole
+ * row away, the others keep square blocks of cells together, so
+ * the neighbours of a cell are usually in the same few cache lines.
+ */
+typedef enum {
+	LAYOUT_ROWS,    // Row-major
+	LAYOUT_BLOCKED, // 8x8 blocks, row-major inside and between them
+	LAYOUT_MORTON,  // 64x64 tiles, Z order inside, row-major between them
+} node_layout;
+extern node_layout layout;
+int layout_parse(const char *name, node_layout *out);
+
 void set_break_search();
-Path find_path(Coordinates start, Coordinates end, heuristic_function heuristic);
+Path find_path(Coordinates start, Coordinates end, heuristic_function heuristic, int agent_size);
+Path find_path_weighted(Coordinates start, Coordinates end, heuristic_function heuristic, double weight, int agent_size);
+Path find_path_anytime(Coordinates start, Coordinates end, heuristic_function heuristic, double weight, int time_budget, int agent_size);
+Path find_path_nearest(Coordinates start, const Coordinates *goals, int n_goals, heuristic_function heuristic, int agent_size);
+Path find_path_theta(Coordinates start, Coordinates end, double weight, int agent_size);
+Path find_path_selected(Coordinates start, Coordinates end);
 
 void put_barrier(Coordinates c);
 bool get_barrier(Coordinates c);
@@ -41,11 +66,14 @@ bool get_visited(Coordinates c);
 
 int path_finding_init();
 void path_finding_free();
+int path_finding_thread_init();
+void path_finding_thread_free();
 
 void prepare_maze(Coordinates pa, Coordinates pb);
 void clear_barriers();
-void random_barriers(Coordinates pa, Coordinates pb);
+int random_barriers(Coordinates pa, Coordinates pb);
 
 void switch_horizontal_movement();
+int get_children(Coordinates c, Node **adj);
 
 #endif
@@ -0,0 +1,920 @@
+/**
+ * Headless path query server.
+ *
+ * The grid is loaded once, and queries are read from stdin or from
+ * a local Unix socket, one request per line:
+ *
+ *   <id> PATH <sx> <sy> <gx> <gy> [heuristic] [weight] [agent size]
+ *   <id> ANYANGLE <sx> <sy> <gx> <gy> [weight] [agent size]
+ *   <id> NEAREST <sx> <sy> <gx> <gy> [<gx> <gy> ...]
+ *   <id> AGENTS <window> <sx> <sy> <gx> <gy> [<sx> <sy> <gx> <gy> ...]
+ *   <id> BARRIER <x> <y> [0|1]
+ *   <id> COST <x> <y> [cost]
+ *   <id> STATS
+ *   <id> FORMAT <cells|packed>
+ *
+ * Every response is a line that starts with the id of its request:
+ *
+ *   <id> OK <length> <bound> <x>,<y> ...  Path from start to goal.
+ *                                         The length is 0 if there's none.
+ *                                         For ANYANGLE, only the ends of
+ *                                         its straight segments
+ *   <id> OK <length> <bound> <x>,<y> <moves>
+ *                                         The same path, packed: its start
+ *                                         and the hex of its moves, 3 bits
+ *                                         each (see path_code.h)
+ *   <id> OK <n> <length> <x>,<y> ...       Path of each agent, one step
+ *                                         per time step (0 is no window)
+ *   <id> OK <0|1>                         New state of the edited cell
+ *   <id> OK <cost>                        Cost of the cell, after the edit
+ *   <id> OK <key>=<value> ...             Stats
+ *   <id> OK <cells|packed>                Format of the paths from now on
+ *   <id> ERR <message>
+ *
+ * Requests can be pipelined. Searches run on a pool of workers, each
+ * one with its own search state, and are answered as they finish, so
+ * their responses can come out of order. Edits and stats are applied
+ * as they are read, so a search sent after an edit always sees it.
+ * The responses that finish while the previous ones are being written
+ * are sent together, in a single write.
+ *
+ * The paths of PATH and NEAREST are written in the format set for the
+ * connection, cells by default. ANYANGLE and AGENTS always use cells,
+ * as their paths have longer moves, or waits.
+ *
+ * Edits go to the working version of the grid, and are published
+ * together before the next search is queued, or when there's nothing
+ * more to read. Each search pins the version published when it starts,
+ * so searches and edits don't wait for each other, except the searches
+ * on the subgoal graph, which is only kept for the working version.
+ */
+#include "server.h"
+#include "path_finding.h"
+#include "grid.h"
+#include "cost.h"
+#include "cooperative.h"
+#include "cpd.h"
+#include "clearance.h"
+#include "subgoal.h"
+#include "arena.h"
+#include "trace.h"
+#include "path_code.h"
+#include <stdio.h>
+
+#ifndef __unix__
+
+int serve(const char *socket_path, int n_workers){
+	(void) socket_path;
+	(void) n_workers;
+	fprintf(stderr, "The server is only supported on unix\n");
+	return 1;
+}
+
+#else
+
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+extern int n_rows;
+extern int n_cols;
+
+#define READ_CHUNK 65536
+#define MAX_GOALS 65536
+#define MAX_AGENTS 4096
+
+typedef struct Buffer {
+	char *data;
+	size_t len;
+	size_t cap;
+} Buffer;
+
+typedef struct Connection {
+	int in_fd;
+	int out_fd;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	Buffer out;
+	int pending;   // Searches queued or running
+	bool reading;
+	bool failed;   // The peer can't be written anymore
+	bool packed;   // Format of the paths, only used by its reader
+} Connection;
+
+typedef struct Request {
+	struct Request *next;
+	Connection *conn;
+	char *line;
+	bool packed;   // Format of the connection when it was sent
+} Request;
+
+static struct {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	Request *head;
+	Request *tail;
+	bool quit;
+} queue = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
+};
+
+// Edits and publishing write the working version of the grid,
+// the searches on the subgoal graph read it
+static pthread_rwlock_t grid_lock = PTHREAD_RWLOCK_INITIALIZER;
+static atomic_bool unpublished;
+
+static int workers;
+static atomic_ulong n_queries;
+static atomic_ulong n_edits;
+static atomic_ulong n_errors;
+static atomic_ullong query_ns;
+
+static int buffer_reserve(Buffer *b, size_t extra){
+	if (b->len + extra <= b->cap){
+		return 1;
+	}
+	size_t cap = b->cap ? b->cap : 256;
+	while (cap < b->len + extra){
+		cap *= 2;
+	}
+	char *data = realloc(b->data, cap);
+	if (!data){
+		return -1;
+	}
+	b->data = data;
+	b->cap = cap;
+	return 1;
+}
+
+static void buffer_printf(Buffer *b, const char *fmt, ...){
+	va_list args;
+	va_start(args, fmt);
+	int n = vsnprintf(NULL, 0, fmt, args);
+	va_end(args);
+	if (n < 0 || buffer_reserve(b, n + 1) != 1){
+		return;
+	}
+	va_start(args, fmt);
+	vsnprintf(b->data + b->len, n + 1, fmt, args);
+	va_end(args);
+	b->len += n;
+}
+
+static double now_ns(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/**
+ * Queues a response to be written to the connection.
+ * done is set when it answers a search.
+ */
+static void respond(Connection *conn, const Buffer *response, bool done){
+	pthread_mutex_lock(&conn->lock);
+	if (buffer_reserve(&conn->out, response->len) == 1){
+		memcpy(conn->out.data + conn->out.len, response->data, response->len);
+		conn->out.len += response->len;
+	}
+	if (done){
+		conn->pending--;
+	}
+	pthread_cond_signal(&conn->cond);
+	pthread_mutex_unlock(&conn->lock);
+}
+
+static bool parse_int(char **save, int *n){
+	char *token = strtok_r(NULL, " \t\r", save);
+	if (!token){
+		return false;
+	}
+	char *end;
+	long value = strtol(token, &end, 10);
+	*n = value;
+	return *end == '\0';
+}
+
+static bool in_grid(int x, int y){
+	return x >= 0 && x < n_cols && y >= 0 && y < n_rows;
+}
+
+// Packed path of the worker, freed when it exits
+static _Thread_local uint8_t *code = NULL;
+static _Thread_local size_t code_capacity = 0;
+
+/**
+ * Parses the rest of the request as goals, in a buffer of the request
+ * the caller frees. Returns how many, or -1 after replying the error.
+ */
+static int parse_goals(Buffer *b, const char *id, char **save, Coordinates **goals){
+	int n_goals = 0, capacity = 0;
+	Coordinates goal;
+	while (parse_int(save, &goal.x)){
+		if (!parse_int(save, &goal.y) || !in_grid(goal.x, goal.y)){
+			buffer_printf(b, "%s ERR invalid goal\n", id);
+			free(*goals);
+			return -1;
+		}
+		if (n_goals == MAX_GOALS){
+			buffer_printf(b, "%s ERR too many goals\n", id);
+			free(*goals);
+			return -1;
+		}
+		if (n_goals == capacity){
+			capacity = capacity > 0 ? capacity * 2 : 16;
+			Coordinates *grown = realloc(*goals, sizeof(Coordinates) * capacity);
+			if (!grown){
+				buffer_printf(b, "%s ERR out of memory\n", id);
+				free(*goals);
+				return -1;
+			}
+			*goals = grown;
+		}
+		(*goals)[n_goals++] = goal;
+	}
+	if (n_goals == 0){
+		buffer_printf(b, "%s ERR no goals\n", id);
+		return -1;
+	}
+	return n_goals;
+}
+
+/**
+ * Writes the path from start to goal, packed if it can be.
+ * If it doesn't begin at start there's no path.
+ */
+static void write_path(Buffer *b, const char *id, Path path, Coordinates start, bool packed){
+	if (path.path_length == 0 || path.path[0].x != start.x || path.path[0].y != start.y){
+		buffer_printf(b, "%s OK 0 1\n", id);
+		return;
+	}
+	buffer_printf(b, "%s OK %d %g", id, path.path_length, path.bound);
+	size_t size = path_code_size(path.path_length);
+	if (packed && size > code_capacity){
+		uint8_t *grown = realloc(code, size);
+		if (grown){
+			code = grown;
+			code_capacity = size;
+		}
+	}
+	if (packed && path_encode(path, code, code_capacity) == 1){
+		// A path of only start has no moves
+		buffer_printf(b, size > 0 ? " %d,%d " : " %d,%d", start.x, start.y);
+		if (buffer_reserve(b, size * 2) == 1){
+			static const char hex[] = "0123456789abcdef";
+			for (size_t i = 0; i < size; i++){
+				b->data[b->len++] = hex[code[i] >> 4];
+				b->data[b->len++] = hex[code[i] & 0xf];
+			}
+		}
+		buffer_printf(b, "\n");
+		return;
+	}
+	for (int i = 0; i < path.path_length; i++){
+		buffer_printf(b, " %d,%d", path.path[i].x, path.path[i].y);
+	}
+	buffer_printf(b, "\n");
+}
+
+/**
+ * The subgoal graph is updated with the edits as they are applied,
+ * not when they are published, so it's searched along with the
+ * working version of the grid, holding the edits off.
+ */
+static Path find_path_working(Coordinates start, Coordinates goal){
+	pthread_rwlock_rdlock(&grid_lock);
+	grid_edit();
+	Path path = subgoal_ready()
+		? find_path_subgoal(start, goal)
+		: find_path_weighted(start, goal, NULL, 1.0, 1);
+	pthread_rwlock_unlock(&grid_lock);
+	return path;
+}
+
+static bool search_request(Buffer *b, const char *id, char *command, char **save, bool packed){
+	Coordinates start;
+	if (!parse_int(save, &start.x) || !parse_int(save, &start.y) || !in_grid(start.x, start.y)){
+		buffer_printf(b, "%s ERR invalid start\n", id);
+		return false;
+	}
+	if (strcmp(command, "PATH") == 0){
+		Coordinates goal;
+		if (!parse_int(save, &goal.x) || !parse_int(save, &goal.y) || !in_grid(goal.x, goal.y)){
+			buffer_printf(b, "%s ERR invalid goal\n", id);
+			return false;
+		}
+		heuristic_function heuristic = NULL;
+		double weight = 1.0;
+		int size = 1;
+		char *token = strtok_r(NULL, " \t\r", save);
+		if (token){
+			heuristic = heuristic_from_name(token);
+			if (!heuristic){
+				buffer_printf(b, "%s ERR unknown heuristic %s\n", id, token);
+				return false;
+			}
+			token = strtok_r(NULL, " \t\r", save);
+			if (token){
+				weight = atof(token);
+			}
+			if (weight < 1.0){
+				buffer_printf(b, "%s ERR the weight must be at least 1.0\n", id);
+				return false;
+			}
+			int n;
+			if (parse_int(save, &n)){
+				if (n <= 0 || n > AGENT_SIZE_MAX){
+					buffer_printf(b, "%s ERR the agent size must be from 1 to %d\n", id, AGENT_SIZE_MAX);
+					return false;
+				}
+				size = n;
+			}
+		}
+		GridVersion *version = grid_acquire();
+		// The path database and the subgoal graph only
+		// hold optimal paths of single cell agents
+		Path path;
+		if (weight == 1.0 && size == 1 && cpd_ready()){
+			path = find_path_cpd(start, goal);
+		}else if (weight == 1.0 && size == 1 && subgoal_ready()){
+			path = find_path_working(start, goal);
+		}else{
+			path = find_path_weighted(start, goal, heuristic, weight, size);
+		}
+		grid_release(version);
+		write_path(b, id, path, start, packed);
+	}else if (strcmp(command, "ANYANGLE") == 0){
+		Coordinates goal;
+		if (!parse_int(save, &goal.x) || !parse_int(save, &goal.y) || !in_grid(goal.x, goal.y)){
+			buffer_printf(b, "%s ERR invalid goal\n", id);
+			return false;
+		}
+		double weight = 1.0;
+		int size = 1;
+		char *token = strtok_r(NULL, " \t\r", save);
+		if (token){
+			weight = atof(token);
+			if (weight < 1.0){
+				buffer_printf(b, "%s ERR the weight must be at least 1.0\n", id);
+				return false;
+			}
+			int n;
+			if (parse_int(save, &n)){
+				if (n <= 0 || n > AGENT_SIZE_MAX){
+					buffer_printf(b, "%s ERR the agent size must be from 1 to %d\n", id, AGENT_SIZE_MAX);
+					return false;
+				}
+				size = n;
+			}
+		}
+		GridVersion *version = grid_acquire();
+		Path path = find_path_theta(start, goal, weight, size);
+		grid_release(version);
+		write_path(b, id, path, start, false);
+	}else{
+		Coordinates *goals = NULL;
+		int n_goals = parse_goals(b, id, save, &goals);
+		if (n_goals < 0){
+			return false;
+		}
+		GridVersion *version = grid_acquire();
+		Path path = find_path_nearest(start, goals, n_goals, NULL, 1);
+		grid_release(version);
+		// Without a path it only holds start, which is not a goal,
+		// or nothing if there was no memory to search
+		bool reached = false;
+		for (int i = 0; !reached && i < n_goals && path.path_length > 0; i++){
+			Coordinates end = path.path[path.path_length - 1];
+			reached = goals[i].x == end.x && goals[i].y == end.y;
+		}
+		free(goals);
+		if (!reached){
+			buffer_printf(b, "%s OK 0 1\n", id);
+			return true;
+		}
+		write_path(b, id, path, start, packed);
+	}
+	return true;
+}
+
+/**
+ * Parses the rest of the request as agents, in a buffer of the request
+ * the caller frees. Returns how many, or -1 after replying the error.
+ */
+static int parse_agents(Buffer *b, const char *id, char **save, Agent **agents){
+	int n_agents = 0, capacity = 0;
+	Agent a;
+	while (parse_int(save, &a.start.x)){
+		if (!parse_int(save, &a.start.y) || !parse_int(save, &a.goal.x) || !parse_int(save, &a.goal.y)
+		    || !in_grid(a.start.x, a.start.y) || !in_grid(a.goal.x, a.goal.y)){
+			buffer_printf(b, "%s ERR invalid agent %d\n", id, n_agents);
+			free(*agents);
+			return -1;
+		}
+		if (n_agents == MAX_AGENTS){
+			buffer_printf(b, "%s ERR too many agents\n", id);
+			free(*agents);
+			return -1;
+		}
+		if (n_agents == capacity){
+			capacity = capacity > 0 ? capacity * 2 : 16;
+			Agent *grown = realloc(*agents, sizeof(Agent) * capacity);
+			if (!grown){
+				buffer_printf(b, "%s ERR out of memory\n", id);
+				free(*agents);
+				return -1;
+			}
+			*agents = grown;
+		}
+		(*agents)[n_agents++] = a;
+	}
+	if (n_agents == 0){
+		buffer_printf(b, "%s ERR no agents\n", id);
+		return -1;
+	}
+	return n_agents;
+}
+
+static bool agents_request(Buffer *b, const char *id, char **save){
+	int window;
+	if (!parse_int(save, &window) || window < 0){
+		buffer_printf(b, "%s ERR invalid window\n", id);
+		return false;
+	}
+	Agent *agents = NULL;
+	int n_agents = parse_agents(b, id, save, &agents);
+	if (n_agents < 0){
+		return false;
+	}
+	Path *paths = malloc(sizeof(Path) * n_agents);
+	int status = -1;
+	if (paths){
+		GridVersion *version = grid_acquire();
+		status = plan_cooperative(agents, n_agents, window, paths);
+		grid_release(version);
+	}
+	free(agents);
+	if (status < 0){
+		free(paths);
+		buffer_printf(b, "%s ERR out of memory\n", id);
+		return false;
+	}
+	buffer_printf(b, "%s OK %d", id, n_agents);
+	for (int i = 0; i < n_agents; i++){
+		buffer_printf(b, " %d", paths[i].path_length);
+		for (int t = 0; t < paths[i].path_length; t++){
+			buffer_printf(b, " %d,%d", paths[i].path[t].x, paths[i].path[t].y);
+		}
+	}
+	buffer_printf(b, "\n");
+	free(paths);
+	return true;
+}
+
+static void* worker(void *arg){
+	(void) arg;
+	trace_thread_name("server worker");
+	if (path_finding_thread_init() != 1){
+		fprintf(stderr, "Error at path_finding_thread_init\n");
+		return NULL;
+	}
+	Buffer response = {0};
+	for (;;){
+		pthread_mutex_lock(&queue.lock);
+		while (!queue.head && !queue.quit){
+			pthread_cond_wait(&queue.cond, &queue.lock);
+		}
+		Request *req = queue.head;
+		if (!req){
+			pthread_mutex_unlock(&queue.lock);
+			break;
+		}
+		queue.head = req->next;
+		if (!queue.head){
+			queue.tail = NULL;
+		}
+		pthread_mutex_unlock(&queue.lock);
+
+		trace_begin("request");
+		double start = now_ns();
+		char *save;
+		char *id = strtok_r(req->line, " \t\r", &save);
+		char *command = strtok_r(NULL, " \t\r", &save);
+		response.len = 0;
+		bool ok = strcmp(command, "AGENTS") == 0
+			? agents_request(&response, id, &save)
+			: search_request(&response, id, command, &save, req->packed);
+		if (!ok){
+			n_errors++;
+		}
+		atomic_fetch_add(&query_ns, (unsigned long long)(now_ns() - start));
+		n_queries++;
+		trace_end();
+
+		respond(req->conn, &response, true);
+		free(req->line);
+		free(req);
+	}
+	free(response.data);
+	free(code);
+	code = NULL;
+	code_capacity = 0;
+	path_finding_thread_free();
+	return NULL;
+}
+
+static void enqueue(Connection *conn, char *line){
+	Request *req = malloc(sizeof(*req));
+	char *copy = strdup(line);
+	if (!req || !copy){
+		free(req);
+		free(copy);
+		return;
+	}
+	*req = (Request){.conn = conn, .line = copy, .packed = conn->packed};
+
+	pthread_mutex_lock(&conn->lock);
+	conn->pending++;
+	pthread_mutex_unlock(&conn->lock);
+
+	pthread_mutex_lock(&queue.lock);
+	if (queue.tail){
+		queue.tail->next = req;
+	}else{
+		queue.head = req;
+	}
+	queue.tail = req;
+	pthread_cond_signal(&queue.cond);
+	pthread_mutex_unlock(&queue.lock);
+}
+
+static void edit_request(Buffer *b, const char *id, char **save){
+	int x, y;
+	if (!parse_int(save, &x) || !parse_int(save, &y) || !in_grid(x, y)){
+		buffer_printf(b, "%s ERR invalid cell\n", id);
+		n_errors++;
+		return;
+	}
+	int value;
+	pthread_rwlock_wrlock(&grid_lock);
+	grid_edit();
+	if (parse_int(save, &value)){
+		if (get_barrier((Coordinates){x, y}) != (value != 0)){
+			put_barrier((Coordinates){x, y});
+		}
+	}else{
+		put_barrier((Coordinates){x, y});
+	}
+	bool barrier = get_barrier((Coordinates){x, y});
+	atomic_store(&unpublished, true);
+	pthread_rwlock_unlock(&grid_lock);
+	n_edits++;
+	buffer_printf(b, "%s OK %d\n", id, barrier);
+}
+
+static void cost_request(Buffer *b, const char *id, char **save){
+	int x, y;
+	if (!parse_int(save, &x) || !parse_int(save, &y) || !in_grid(x, y)){
+		buffer_printf(b, "%s ERR invalid cell\n", id);
+		n_errors++;
+		return;
+	}
+	int value;
+	if (!parse_int(save, &value)){
+		pthread_rwlock_rdlock(&grid_lock);
+		grid_edit();
+		value = cost_get(x, y);
+		pthread_rwlock_unlock(&grid_lock);
+		buffer_printf(b, "%s OK %d\n", id, value);
+		return;
+	}
+	if (value < COST_MIN || value > COST_MAX){
+		buffer_printf(b, "%s ERR the cost must be between %d and %d\n", id, COST_MIN, COST_MAX);
+		n_errors++;
+		return;
+	}
+	pthread_rwlock_wrlock(&grid_lock);
+	grid_edit();
+	cost_set(x, y, value);
+	atomic_store(&unpublished, true);
+	pthread_rwlock_unlock(&grid_lock);
+	n_edits++;
+	buffer_printf(b, "%s OK %d\n", id, value);
+}
+
+/**
+ * Publishes the edits applied so far, if any, so
+ * the searches that start from now on see them.
+ */
+static void publish(void){
+	if (!atomic_load(&unpublished)){
+		return;
+	}
+	trace_begin("publish");
+	pthread_rwlock_wrlock(&grid_lock);
+	if (atomic_exchange(&unpublished, false)){
+		grid_publish();
+	}
+	pthread_rwlock_unlock(&grid_lock);
+	trace_end();
+}
+
+static void stats_request(Buffer *b, const char *id){
+	unsigned long queries = n_queries;
+	double mean_us = queries ? query_ns / 1e3 / queries : 0;
+	buffer_printf(b, "%s OK rows=%d cols=%d workers=%d queries=%lu edits=%lu errors=%lu mean_query_us=%.1f scratch_peak_bytes=%zu grid_versions=%ld\n",
+		      id, n_rows, n_cols, workers, queries, (unsigned long)n_edits,
+		      (unsigned long)n_errors, mean_us, arena_peak(), grid_live_versions());
+}
+
+/**
+ * Sets the format of the paths of the searches
+ * the connection sends from now on.
+ */
+static void format_request(Connection *conn, Buffer *b, const char *id, char **save){
+	char *token = strtok_r(NULL, " \t\r", save);
+	if (token && strcmp(token, "cells") == 0){
+		conn->packed = false;
+	}else if (token && strcmp(token, "packed") == 0){
+		conn->packed = true;
+	}else{
+		buffer_printf(b, "%s ERR unknown format %s\n", id, token ? token : "");
+		n_errors++;
+		return;
+	}
+	buffer_printf(b, "%s OK %s\n", id, token);
+}
+
+/**
+ * Handles a line of the connection. Searches go to the workers,
+ * the rest is answered right away.
+ */
+static void handle_line(Connection *conn, char *line, Buffer *response){
+	char *copy = strdup(line);
+	if (!copy){
+		return;
+	}
+	char *save;
+	char *id = strtok_r(copy, " \t\r", &save);
+	char *command = id ? strtok_r(NULL, " \t\r", &save) : NULL;
+	response->len = 0;
+	if (!id){
+		// Empty line
+	}else if (!command){
+		buffer_printf(response, "%s ERR missing command\n", id);
+		n_errors++;
+	}else if (strcmp(command, "PATH") == 0 || strcmp(command, "NEAREST") == 0
+		   || strcmp(command, "AGENTS") == 0 || strcmp(command, "ANYANGLE") == 0){
+		publish();
+		enqueue(conn, line);
+	}else if (strcmp(command, "BARRIER") == 0){
+		edit_request(response, id, &save);
+	}else if (strcmp(command, "COST") == 0){
+		cost_request(response, id, &save);
+	}else if (strcmp(command, "STATS") == 0){
+		stats_request(response, id);
+	}else if (strcmp(command, "FORMAT") == 0){
+		format_request(conn, response, id, &save);
+	}else{
+		buffer_printf(response, "%s ERR unknown command %s\n", id, command);
+		n_errors++;
+	}
+	if (response->len > 0){
+		respond(conn, response, false);
+	}
+	free(copy);
+}
+
+static bool write_all(int fd, const char *data, size_t len){
+	while (len > 0){
+		ssize_t n = write(fd, data, len);
+		if (n < 0){
+			if (errno == EINTR){
+				continue;
+			}
+			return false;
+		}
+		data += n;
+		len -= n;
+	}
+	return true;
+}
+
+/**
+ * Writes the responses of the connection, as many as
+ * there are ready each time, until there's no more to come.
+ */
+static void* writer(void *arg){
+	Connection *conn = arg;
+	trace_thread_name("writer");
+	Buffer batch = {0};
+	pthread_mutex_lock(&conn->lock);
+	for (;;){
+		while (conn->out.len == 0 && (conn->reading || conn->pending > 0)){
+			pthread_cond_wait(&conn->cond, &conn->lock);
+		}
+		if (conn->out.len == 0){
+			break;
+		}
+		Buffer tmp = batch;
+		batch = conn->out;
+		conn->out = tmp;
+		conn->out.len = 0;
+		pthread_mutex_unlock(&conn->lock);
+
+		trace_begin("write");
+		bool ok = conn->failed || write_all(conn->out_fd, batch.data, batch.len);
+		trace_end();
+
+		pthread_mutex_lock(&conn->lock);
+		if (!ok){
+			conn->failed = true;
+		}
+	}
+	pthread_mutex_unlock(&conn->lock);
+	free(batch.data);
+	return NULL;
+}
+
+/**
+ * Reads and handles the requests of a connection until it's
+ * closed, and waits for all its responses to be written.
+ */
+static void serve_connection(int in_fd, int out_fd){
+	Connection *conn = calloc(1, sizeof(*conn));
+	char *buf = malloc(READ_CHUNK);
+	if (!conn || !buf){
+		free(conn);
+		free(buf);
+		return;
+	}
+	conn->in_fd = in_fd;
+	conn->out_fd = out_fd;
+	conn->reading = true;
+	pthread_mutex_init(&conn->lock, NULL);
+	pthread_cond_init(&conn->cond, NULL);
+
+	pthread_t writer_thread;
+	if (pthread_create(&writer_thread, NULL, writer, conn) != 0){
+		free(conn);
+		free(buf);
+		return;
+	}
+
+	Buffer line = {0};
+	Buffer response = {0};
+	ssize_t n;
+	while ((n = read(in_fd, buf, READ_CHUNK)) != 0){
+		if (n < 0){
+			if (errno == EINTR){
+				continue;
+			}
+			break;
+		}
+		for (ssize_t i = 0; i < n; i++){
+			if (buf[i] != '\n'){
+				if (buffer_reserve(&line, 2) == 1){
+					line.data[line.len++] = buf[i];
+				}
+				continue;
+			}
+			if (line.len == 0){
+				// Empty line, maybe with nothing read yet
+				continue;
+			}
+			line.data[line.len] = '\0';
+			handle_line(conn, line.data, &response);
+			line.len = 0;
+		}
+		publish();
+	}
+	if (line.len > 0){
+		line.data[line.len] = '\0';
+		handle_line(conn, line.data, &response);
+		publish();
+	}
+
+	pthread_mutex_lock(&conn->lock);
+	conn->reading = false;
+	pthread_cond_signal(&conn->cond);
+	pthread_mutex_unlock(&conn->lock);
+	pthread_join(writer_thread, NULL);
+
+	pthread_mutex_destroy(&conn->lock);
+	pthread_cond_destroy(&conn->cond);
+	free(conn->out.data);
+	free(conn);
+	free(line.data);
+	free(response.data);
+	free(buf);
+}
+
+static void* connection_thread(void *arg){
+	int fd = (int)(long)arg;
+	trace_thread_name("connection");
+	serve_connection(fd, fd);
+	close(fd);
+	return NULL;
+}
+
+static int listen_socket(const char *socket_path){
+	struct sockaddr_un addr = {.sun_family = AF_UNIX};
+	if (strlen(socket_path) >= sizeof(addr.sun_path)){
+		fprintf(stderr, "Socket path too long: %s\n", socket_path);
+		return -1;
+	}
+	strcpy(addr.sun_path, socket_path);
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0){
+		perror("socket");
+		return -1;
+	}
+	unlink(socket_path);
+	if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(fd, SOMAXCONN) != 0){
+		perror(socket_path);
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/**
+ * Serves queries on the grid with n_workers search threads.
+ * If socket_path is NULL or "-" the requests are read from stdin
+ * and answered on stdout, until stdin is closed. Otherwise it
+ * listens on a Unix socket with that path, forever.
+ */
+int serve(const char *socket_path, int n_workers){
+	if (n_workers <= 0){
+		n_workers = sysconf(_SC_NPROCESSORS_ONLN);
+		if (n_workers <= 0){
+			n_workers = 1;
+		}
+	}
+	signal(SIGPIPE, SIG_IGN);
+
+	int listen_fd = -1;
+	bool use_stdin = !socket_path || strcmp(socket_path, "-") == 0;
+	if (!use_stdin && (listen_fd = listen_socket(socket_path)) < 0){
+		return 1;
+	}
+
+	// The searches start from the grid as it was loaded
+	grid_publish();
+
+	pthread_t threads[n_workers];
+	workers = 0;
+	for (int i = 0; i < n_workers; i++){
+		if (pthread_create(&threads[workers], NULL, worker, NULL) == 0){
+			workers++;
+		}
+	}
+	if (workers == 0){
+		fprintf(stderr, "Can't start the workers\n");
+		return 1;
+	}
+
+	if (use_stdin){
+		serve_connection(STDIN_FILENO, STDOUT_FILENO);
+	}else{
+		fprintf(stderr, "Listening on %s with %d workers\n", socket_path, workers);
+		for (;;){
+			int fd = accept(listen_fd, NULL, NULL);
+			if (fd < 0){
+				if (errno == EINTR || errno == ECONNABORTED){
+					continue;
+				}
+				perror("accept");
+				break;
+			}
+			pthread_t thread;
+			if (pthread_create(&thread, NULL, connection_thread, (void*)(long)fd) != 0){
+				close(fd);
+				continue;
+			}
+			pthread_detach(thread);
+		}
+		close(listen_fd);
+		unlink(socket_path);
+	}
+
+	pthread_mutex_lock(&queue.lock);
+	queue.quit = true;
+	pthread_cond_broadcast(&queue.cond);
+	pthread_mutex_unlock(&queue.lock);
+	for (int i = 0; i < workers; i++){
+		pthread_join(threads[i], NULL);
+	}
+	return 0;
+}
+
+#endif
@@ -0,0 +1,9 @@
+/**
+ * Headless path query server.
+ */
+#ifndef SERVER_H
+#define SERVER_H
+
+int serve(const char *socket_path, int n_workers);
+
+#endif // SERVER_H
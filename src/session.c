@@ -0,0 +1,323 @@
+/**
+ * Recording and replay of GUI editing sessions.
+ *
+ * Layout:
+ *   SessionHeader
+ *   barrier bitmap, n_rows * grid_row_words words
+ *   SessionRecord, until the end of the file
+ */
+#include "session.h"
+#include "path_finding.h"
+#include "grid.h"
+#include "clearance.h"
+#include "cost.h"
+#include "subgoal.h"
+#include "generator.h"
+#include "arena.h"
+#include "trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+
+extern int n_rows;
+extern int n_cols;
+extern bool horizontal_movement;
+
+// Recording
+static FILE *out = NULL;
+static double start_ms;
+
+// Loaded session
+static SessionHeader header;
+static uint64_t *bits = NULL;
+static SessionRecord *records = NULL;
+static long n_records = 0;
+
+static const char *op_names[SESSION_N_OPS] = {
+	[SESSION_BARRIER] = "barrier",
+	[SESSION_MAZE] = "maze",
+	[SESSION_CLEAR] = "clear",
+	[SESSION_RANDOM] = "random",
+	[SESSION_MOVEMENT] = "movement",
+	[SESSION_PATH] = "path",
+	[SESSION_COST] = "cost",
+};
+
+static double now_ms(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static inline uint64_t bitmap_words(void){
+	return (uint64_t)n_rows * ((n_cols + GRID_WORD_BITS - 1) / GRID_WORD_BITS);
+}
+
+/**
+ * Starts recording to filename, from the current grid.
+ */
+int session_record_start(const char *filename){
+	out = fopen(filename, "wb");
+	if (!out){
+		return -1;
+	}
+	// The seed is taken from the clock on first use, which
+	// must happen now to be written to the header
+	if (generator_seed == 0){
+		generator_seed = time(NULL);
+	}
+	SessionHeader h = {
+		.magic = SESSION_MAGIC,
+		.version = SESSION_VERSION,
+		.byte_order = SESSION_BYTE_ORDER,
+		.n_rows = n_rows,
+		.n_cols = n_cols,
+		.seed = generator_seed,
+		.horizontal_movement = horizontal_movement,
+	};
+	bool written = fwrite(&h, sizeof(h), 1, out) == 1;
+	for (int y = 0; y < n_rows && written; y++){
+		written = fwrite(grid_row(y), sizeof(uint64_t), grid_row_words, out) == (size_t)grid_row_words;
+	}
+	if (!written){
+		fclose(out);
+		out = NULL;
+		return -1;
+	}
+	start_ms = now_ms();
+	// A session starts with every cell at COST_DEFAULT,
+	// so the rest are recorded as if they were painted
+	if (!cost_uniform() || cost_lowest() != COST_DEFAULT){
+		for (int y = 0; y < n_rows; y++){
+			for (int x = 0; x < n_cols; x++){
+				if (cost_get(x, y) != COST_DEFAULT){
+					session_record(SESSION_COST, x, y, cost_get(x, y), 0);
+				}
+			}
+		}
+	}
+	return 1;
+}
+
+/**
+ * Appends a request to the session being recorded, if any.
+ * The arguments that op doesn't take are ignored.
+ */
+void session_record(session_op op, int a0, int a1, int a2, int a3){
+	if (!out){
+		return;
+	}
+	SessionRecord r = {
+		.time_ms = (uint32_t)(now_ms() - start_ms),
+		.op = op,
+		.args = {a0, a1, a2, a3},
+	};
+	if (fwrite(&r, sizeof(r), 1, out) != 1){
+		fprintf(stderr, "Error recording the session, it stops here\n");
+		fclose(out);
+		out = NULL;
+	}
+}
+
+void session_record_stop(void){
+	if (out && fclose(out) != 0){
+		fprintf(stderr, "Error recording the session\n");
+	}
+	out = NULL;
+}
+
+static bool in_grid(int x, int y){
+	return x >= 0 && x < n_cols && y >= 0 && y < n_rows;
+}
+
+static bool valid_record(const SessionRecord *r){
+	switch (r->op){
+	case SESSION_BARRIER:
+		return in_grid(r->args[0], r->args[1]);
+	case SESSION_COST:
+		return in_grid(r->args[0], r->args[1]) && r->args[2] >= COST_MIN && r->args[2] <= COST_MAX;
+	case SESSION_MAZE:
+	case SESSION_RANDOM:
+	case SESSION_PATH:
+		return in_grid(r->args[0], r->args[1]) && in_grid(r->args[2], r->args[3]);
+	case SESSION_CLEAR:
+	case SESSION_MOVEMENT:
+		return true;
+	default:
+		return false;
+	}
+}
+
+/**
+ * Reads a recorded session, and sets the dimensions of the grid
+ * to its own. It must be called before path_finding_init.
+ */
+int session_load(const char *filename){
+	FILE *f = fopen(filename, "rb");
+	if (!f){
+		return -1;
+	}
+	int status = -1;
+	if (fread(&header, sizeof(header), 1, f) != 1
+	    || memcmp(header.magic, SESSION_MAGIC, sizeof(header.magic)) != 0
+	    || header.version != SESSION_VERSION
+	    || header.byte_order != SESSION_BYTE_ORDER
+	    || header.n_rows <= 0 || header.n_cols <= 0){
+		goto end;
+	}
+	n_rows = header.n_rows;
+	n_cols = header.n_cols;
+	bits = malloc(bitmap_words() * sizeof(uint64_t));
+	if (!bits || fread(bits, sizeof(uint64_t), bitmap_words(), f) != bitmap_words()){
+		goto end;
+	}
+	long capacity = 1024;
+	records = malloc(capacity * sizeof(*records));
+	if (!records){
+		goto end;
+	}
+	for (;;){
+		if (n_records == capacity){
+			capacity *= 2;
+			SessionRecord *tmp = realloc(records, capacity * sizeof(*records));
+			if (!tmp){
+				goto end;
+			}
+			records = tmp;
+		}
+		size_t n = fread(&records[n_records], sizeof(*records), capacity - n_records, f);
+		n_records += n;
+		if (n_records < capacity){
+			break;
+		}
+	}
+	if (ferror(f)){
+		goto end;
+	}
+	for (long i = 0; i < n_records; i++){
+		if (!valid_record(&records[i])){
+			goto end;
+		}
+	}
+	status = 1;
+end:
+	fclose(f);
+	if (status != 1){
+		session_unload();
+	}
+	return status;
+}
+
+void session_unload(void){
+	free(bits);
+	free(records);
+	bits = NULL;
+	records = NULL;
+	n_records = 0;
+}
+
+static int compare_doubles(const void *a, const void *b){
+	double x = *(const double*)a;
+	double y = *(const double*)b;
+	return (x > y) - (x < y);
+}
+
+static double percentile(const double *sorted, long n, int pct){
+	long i = (n * pct + 99) / 100 - 1;
+	return sorted[i < 0 ? 0 : i];
+}
+
+/**
+ * Replays the loaded session from its initial grid, as fast as
+ * possible, and prints the latency of each kind of request.
+ * The paths are found with the search chosen in the command line,
+ * so the same session can compare different searches.
+ */
+int session_replay(void){
+	grid_layer_write(GRID_BARRIERS, bits);
+	clearance_build();
+	subgoal_build();
+	cost_fill(COST_DEFAULT);
+	horizontal_movement = header.horizontal_movement;
+	generator_seed = header.seed;
+
+	double *latencies = malloc((n_records + 1) * sizeof(double));
+	long count[SESSION_N_OPS] = {0};
+	long first[SESSION_N_OPS];
+	if (!latencies){
+		return -1;
+	}
+	// Grouped by op, to sort each group in place
+	long n = 0;
+	for (int op = 1; op < SESSION_N_OPS; op++){
+		first[op] = n;
+		for (long i = 0; i < n_records; i++){
+			count[op] += records[i].op == op;
+		}
+		n += count[op];
+	}
+	long filled[SESSION_N_OPS] = {0};
+	long path_cells = 0;
+	double replay_start = now_ms();
+	for (long i = 0; i < n_records; i++){
+		const SessionRecord *r = &records[i];
+		Coordinates a = {r->args[0], r->args[1]};
+		Coordinates b = {r->args[2], r->args[3]};
+		double t = now_ms();
+		switch (r->op){
+		case SESSION_BARRIER:
+			put_barrier(a);
+			break;
+		case SESSION_MAZE:
+			prepare_maze(a, b);
+			break;
+		case SESSION_CLEAR:
+			clear_barriers();
+			break;
+		case SESSION_RANDOM:
+			if (random_barriers(a, b) != 1){
+				fprintf(stderr, "Error generating the grid\n");
+			}
+			break;
+		case SESSION_MOVEMENT:
+			switch_horizontal_movement();
+			break;
+		case SESSION_PATH:
+			trace_begin("find_path");
+			path_cells += find_path_selected(a, b).path_length;
+			trace_end();
+			break;
+		case SESSION_COST:
+			cost_set(a.x, a.y, r->args[2]);
+			break;
+		}
+		latencies[first[r->op] + filled[r->op]++] = now_ms() - t;
+	}
+	double replay_ms = now_ms() - replay_start;
+
+	printf("Replayed %ld requests of a %.1f s session in %.3f s\n", n_records,
+	       n_records ? records[n_records - 1].time_ms / 1e3 : 0.0, replay_ms / 1e3);
+	printf("%-10s %8s %10s %10s %10s %10s %10s\n", "request", "count", "mean ms", "p50 ms", "p95 ms", "p99 ms", "max ms");
+	for (int op = 1; op < SESSION_N_OPS; op++){
+		if (count[op] == 0){
+			continue;
+		}
+		double *l = &latencies[first[op]];
+		qsort(l, count[op], sizeof(double), compare_doubles);
+		double sum = 0;
+		for (long i = 0; i < count[op]; i++){
+			sum += l[i];
+		}
+		printf("%-10s %8ld %10.3f %10.3f %10.3f %10.3f %10.3f\n", op_names[op], count[op],
+		       sum / count[op], percentile(l, count[op], 50), percentile(l, count[op], 95),
+		       percentile(l, count[op], 99), l[count[op] - 1]);
+	}
+	if (count[SESSION_PATH] > 0){
+		printf("Mean path length: %.1f cells\n", (double)path_cells / count[SESSION_PATH]);
+	}
+	printf("Search scratch memory: %.1f KB at most\n", arena_peak() / 1024.0);
+	free(latencies);
+	return 1;
+}
@@ -0,0 +1,59 @@
+/**
+ * Recording and replay of GUI editing sessions.
+ * A recorded session is replayed without a window, with
+ * the latency of every request measured, so real editing
+ * can be used as a benchmark.
+ */
+#ifndef SESSION_H
+#define SESSION_H
+
+#include <stdint.h>
+
+#define SESSION_MAGIC "PFSESS\r\n"
+#define SESSION_VERSION 1
+#define SESSION_BYTE_ORDER 0x01020304u
+
+typedef enum {
+	SESSION_BARRIER = 1,  // x, y: put_barrier
+	SESSION_MAZE = 2,     // ax, ay, bx, by: prepare_maze
+	SESSION_CLEAR = 3,    // clear_barriers
+	SESSION_RANDOM = 4,   // ax, ay, bx, by: random_barriers
+	SESSION_MOVEMENT = 5, // switch_horizontal_movement
+	SESSION_PATH = 6,     // ax, ay, bx, by: a search from a to b
+	SESSION_COST = 7,     // x, y, cost: cost_set
+} session_op;
+#define SESSION_N_OPS 8
+
+/*
+ * The header is followed by the barrier bitmap at the
+ * start of the session, laid out like in grid_layer_read, and
+ * then by the records until the end of the file. Every
+ * cell costs COST_DEFAULT at the start.
+ */
+typedef struct SessionHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t byte_order;  // SESSION_BYTE_ORDER, as written by the host
+	int32_t n_rows;
+	int32_t n_cols;
+	uint64_t seed;        // generator_seed, so random_barriers repeats its grids
+	uint32_t horizontal_movement;
+	uint32_t reserved;
+} SessionHeader;
+
+typedef struct SessionRecord {
+	uint32_t time_ms;     // Since the start of the session
+	uint16_t op;
+	uint16_t reserved;
+	int32_t args[4];
+} SessionRecord;
+
+int session_record_start(const char *filename);
+void session_record(session_op op, int a0, int a1, int a2, int a3);
+void session_record_stop(void);
+
+int session_load(const char *filename);
+int session_replay(void);
+void session_unload(void);
+
+#endif // SESSION_H
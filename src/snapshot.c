@@ -0,0 +1,330 @@
+/**
+ * Binary snapshot of the grid.
+ *
+ * Layout:
+ *   SnapshotHeader
+ *   SnapshotSection[n_sections]
+ *   sections, each one aligned to SNAPSHOT_ALIGN, and padded with zeros
+ */
+#include "snapshot.h"
+#include "grid.h"
+#include "cost.h"
+#include "cpd.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#ifdef __unix__
+#    include <fcntl.h>
+#    include <unistd.h>
+#    include <sys/mman.h>
+#    include <sys/stat.h>
+#endif
+
+extern int n_rows;
+extern int n_cols;
+
+#define MAX_SECTIONS 16
+
+static unsigned char *mapped = NULL;
+static uint64_t mapped_size = 0;
+
+typedef struct SectionData {
+	uint32_t id;
+	const void *data;    // NULL for a layer of the grid
+	grid_layer layer;
+	uint64_t size;
+} SectionData;
+
+static inline uint64_t align_up(uint64_t n){
+	return (n + SNAPSHOT_ALIGN - 1) / SNAPSHOT_ALIGN * SNAPSHOT_ALIGN;
+}
+
+/**
+ * 64 bit checksum of n words. Four independent lanes
+ * are mixed, so the multiplications can overlap.
+ */
+static uint64_t checksum(const uint64_t *words, uint64_t n){
+	const uint64_t k = 0xFF51AFD7ED558CCDULL;
+	uint64_t lanes[4] = {
+		0x9E3779B97F4A7C15ULL, 0xC2B2AE3D27D4EB4FULL,
+		0x165667B19E3779F9ULL, 0x27D4EB2F165667C5ULL
+	};
+	uint64_t i = 0;
+	for (; i + 4 <= n; i += 4){
+		for (int l = 0; l < 4; l++){
+			lanes[l] = (lanes[l] ^ words[i + l]) * k;
+			lanes[l] ^= lanes[l] >> 29;
+		}
+	}
+	for (; i < n; i++){
+		lanes[0] = (lanes[0] ^ words[i]) * k;
+		lanes[0] ^= lanes[0] >> 29;
+	}
+	uint64_t h = n;
+	for (int l = 0; l < 4; l++){
+		h = (h ^ lanes[l]) * k;
+		h ^= h >> 32;
+	}
+	return h;
+}
+
+/**
+ * Gathers the sections to be saved: the barriers,
+ * and every precomputed index that has been built.
+ */
+static int collect_sections(SectionData *sections){
+	int n = 0;
+	sections[n++] = (SectionData){
+		.id = SNAPSHOT_BARRIERS,
+		.layer = GRID_BARRIERS,
+		.size = (uint64_t)n_rows * grid_row_size[GRID_BARRIERS]
+	};
+	sections[n++] = (SectionData){
+		.id = SNAPSHOT_CLEARANCE,
+		.layer = GRID_CLEARANCE,
+		.size = (uint64_t)n_rows * n_cols
+	};
+	// Without a cost section, every cell costs COST_DEFAULT
+	if (!cost_uniform() || cost_lowest() != COST_DEFAULT){
+		sections[n++] = (SectionData){
+			.id = SNAPSHOT_COSTS,
+			.layer = GRID_COSTS,
+			.size = (uint64_t)n_rows * n_cols
+		};
+	}
+	if (cpd_ready()){
+		sections[n].id = SNAPSHOT_CPD;
+		sections[n].data = cpd_data(&sections[n].size);
+		n++;
+	}
+	return n;
+}
+
+int snapshot_save(const char *filename){
+	SectionData data[MAX_SECTIONS];
+	int n_sections = collect_sections(data);
+
+	uint64_t table_size = sizeof(SnapshotSection) * n_sections;
+	uint64_t size = align_up(sizeof(SnapshotHeader) + table_size);
+	SnapshotSection table[MAX_SECTIONS];
+	for (int i = 0; i < n_sections; i++){
+		table[i] = (SnapshotSection){
+			.id = data[i].id,
+			.offset = size,
+			.size = data[i].size
+		};
+		size = align_up(size + data[i].size);
+	}
+
+	unsigned char *buffer = calloc(size, 1);
+	if (!buffer){
+		return -1;
+	}
+	for (int i = 0; i < n_sections; i++){
+		if (data[i].data){
+			memcpy(buffer + table[i].offset, data[i].data, data[i].size);
+		}else{
+			grid_layer_read(data[i].layer, buffer + table[i].offset);
+		}
+		table[i].checksum = checksum((uint64_t*)(buffer + table[i].offset),
+					     align_up(data[i].size) / sizeof(uint64_t));
+	}
+	memcpy(buffer + sizeof(SnapshotHeader), table, table_size);
+	SnapshotHeader header = {
+		.version = SNAPSHOT_VERSION,
+		.byte_order = SNAPSHOT_BYTE_ORDER,
+		.n_rows = n_rows,
+		.n_cols = n_cols,
+		.n_sections = n_sections,
+		.size = size
+	};
+	memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+	header.checksum = checksum((uint64_t*)table, table_size / sizeof(uint64_t));
+	memcpy(buffer, &header, sizeof(header));
+
+	FILE *f = fopen(filename, "wb");
+	if (!f){
+		free(buffer);
+		return -1;
+	}
+	bool ok = fwrite(buffer, 1, size, f) == size;
+	free(buffer);
+	if (fclose(f) != 0){
+		ok = false;
+	}
+	return ok ? 1 : -1;
+}
+
+/**
+ * Maps the file in memory. The mapping is private: edits to the
+ * grid are copied on write, and never reach the file.
+ */
+static int map_file(const char *filename){
+#ifdef __unix__
+	int fd = open(filename, O_RDONLY);
+	if (fd < 0){
+		return -1;
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0 || (uint64_t)st.st_size < sizeof(SnapshotHeader)){
+		close(fd);
+		return -1;
+	}
+	void *addr = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (addr == MAP_FAILED){
+		return -1;
+	}
+	mapped = addr;
+	mapped_size = st.st_size;
+	return 1;
+#else
+	FILE *f = fopen(filename, "rb");
+	if (!f){
+		return -1;
+	}
+	fseek(f, 0, SEEK_END);
+	long size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	if (size < (long)sizeof(SnapshotHeader) || !(mapped = malloc(size))){
+		fclose(f);
+		return -1;
+	}
+	mapped_size = size;
+	bool ok = fread(mapped, 1, size, f) == (size_t)size;
+	fclose(f);
+	if (!ok){
+		snapshot_unload();
+		return -1;
+	}
+	return 1;
+#endif
+}
+
+/**
+ * Checks the header and the section table, not the sections,
+ * so only their pages are read.
+ */
+static bool valid_snapshot(void){
+	const SnapshotHeader *header = (const SnapshotHeader*)mapped;
+	if (memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) != 0
+	    || header->version != SNAPSHOT_VERSION
+	    || header->byte_order != SNAPSHOT_BYTE_ORDER
+	    || header->size != mapped_size
+	    || header->n_rows <= 0 || header->n_cols <= 0
+	    || header->n_sections > MAX_SECTIONS){
+		return false;
+	}
+	uint64_t table_end = sizeof(SnapshotHeader) + sizeof(SnapshotSection) * header->n_sections;
+	if (table_end > mapped_size){
+		return false;
+	}
+	const SnapshotSection *table = (const SnapshotSection*)(mapped + sizeof(SnapshotHeader));
+	for (uint32_t i = 0; i < header->n_sections; i++){
+		if (table[i].offset % SNAPSHOT_ALIGN != 0
+		    || table[i].offset < table_end
+		    || table[i].offset > mapped_size
+		    || table[i].size > mapped_size - table[i].offset
+		    || align_up(table[i].size) > mapped_size - table[i].offset){
+			return false;
+		}
+	}
+	uint64_t sum = checksum((const uint64_t*)table,
+				sizeof(SnapshotSection) * header->n_sections / sizeof(uint64_t));
+	return sum == header->checksum;
+}
+
+/**
+ * Loads a snapshot. It must be called before path_finding_init,
+ * since it sets the dimensions of the grid. The barriers are used
+ * in place, and the rest of sections can be looked up with
+ * snapshot_section.
+ */
+int snapshot_load(const char *filename){
+	if (map_file(filename) != 1){
+		return -1;
+	}
+	if (!valid_snapshot()){
+		snapshot_unload();
+		return -1;
+	}
+	const SnapshotHeader *header = (const SnapshotHeader*)mapped;
+	n_rows = header->n_rows;
+	n_cols = header->n_cols;
+
+	uint64_t size;
+	uint64_t *bits = (uint64_t*)snapshot_section(SNAPSHOT_BARRIERS, &size);
+	uint64_t row_words = (n_cols + GRID_WORD_BITS - 1) / GRID_WORD_BITS;
+	if (!bits || size != (uint64_t)n_rows * row_words * sizeof(uint64_t)){
+		snapshot_unload();
+		return -1;
+	}
+	grid_attach(GRID_BARRIERS, bits);
+
+	// Without a clearance section, it is built on init
+	uint8_t *map = (uint8_t*)snapshot_section(SNAPSHOT_CLEARANCE, &size);
+	if (map && size == (uint64_t)n_rows * n_cols){
+		grid_attach(GRID_CLEARANCE, map);
+	}
+	uint8_t *costs = (uint8_t*)snapshot_section(SNAPSHOT_COSTS, &size);
+	if (costs && size == (uint64_t)n_rows * n_cols){
+		grid_attach(GRID_COSTS, costs);
+	}
+	return 1;
+}
+
+/**
+ * Checks the sections of the loaded snapshot against their checksums,
+ * which reads all of them. Returns -1 if some section doesn't match.
+ */
+int snapshot_verify(void){
+	if (!mapped){
+		return -1;
+	}
+	const SnapshotHeader *header = (const SnapshotHeader*)mapped;
+	const SnapshotSection *table = (const SnapshotSection*)(mapped + sizeof(SnapshotHeader));
+	for (uint32_t i = 0; i < header->n_sections; i++){
+		uint64_t sum = checksum((const uint64_t*)(mapped + table[i].offset),
+					align_up(table[i].size) / sizeof(uint64_t));
+		if (sum != table[i].checksum){
+			return -1;
+		}
+	}
+	return 1;
+}
+
+void snapshot_unload(void){
+	if (!mapped){
+		return;
+	}
+#ifdef __unix__
+	munmap(mapped, mapped_size);
+#else
+	free(mapped);
+#endif
+	mapped = NULL;
+	mapped_size = 0;
+}
+
+/**
+ * Returns the section with the given id of the loaded
+ * snapshot, or NULL if it's not there.
+ */
+const void* snapshot_section(uint32_t id, uint64_t *size){
+	if (!mapped){
+		return NULL;
+	}
+	const SnapshotHeader *header = (const SnapshotHeader*)mapped;
+	const SnapshotSection *table = (const SnapshotSection*)(mapped + sizeof(SnapshotHeader));
+	for (uint32_t i = 0; i < header->n_sections; i++){
+		if (table[i].id == id){
+			if (size){
+				*size = table[i].size;
+			}
+			return mapped + table[i].offset;
+		}
+	}
+	return NULL;
+}
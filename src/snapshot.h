@@ -0,0 +1,53 @@
+/**
+ * Binary snapshot of the grid and its precomputed indexes.
+ * The file is mapped in memory and used in place, so loading
+ * doesn't parse nor copy anything. Only the header and the section
+ * table are checked then, the sections are read as they are used.
+ * snapshot_verify checks them too.
+ */
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stdint.h>
+
+#define SNAPSHOT_MAGIC "PFSNAP\r\n"
+#define SNAPSHOT_VERSION 2
+#define SNAPSHOT_BYTE_ORDER 0x01020304u
+// Every section starts at a multiple of this
+#define SNAPSHOT_ALIGN 64
+
+typedef enum {
+	SNAPSHOT_BARRIERS = 1,  // The barrier bitmap, laid out like in grid_layer_read
+	SNAPSHOT_CLEARANCE = 2, // The clearance map, one byte per cell
+	SNAPSHOT_CPD = 3,       // The compressed path database, as a single block
+	SNAPSHOT_COSTS = 4,     // The cost map, one byte per cell
+} snapshot_section_id;
+
+typedef struct SnapshotHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t byte_order;  // SNAPSHOT_BYTE_ORDER, as written by the host
+	int32_t n_rows;
+	int32_t n_cols;
+	uint32_t n_sections;
+	uint32_t reserved;
+	uint64_t checksum;    // Of the section table
+	uint64_t size;        // Of the whole file
+} SnapshotHeader;
+
+typedef struct SnapshotSection {
+	uint32_t id;
+	uint32_t reserved;
+	uint64_t offset;      // From the start of the file
+	uint64_t size;
+	uint64_t checksum;    // Of the section, padded to SNAPSHOT_ALIGN
+} SnapshotSection;
+
+int snapshot_save(const char *filename);
+int snapshot_load(const char *filename);
+int snapshot_verify(void);
+void snapshot_unload(void);
+
+const void* snapshot_section(uint32_t id, uint64_t *size);
+
+#endif // SNAPSHOT_H
@@ -0,0 +1,716 @@
+/**
+ * Simple subgoal graph (SSG).
+ * Diagonal moves can cut the corners of the barriers in this grid, so
+ * optimal 8-connected paths turn around the end of a barrier right next
+ * to it. The subgoals are those cells: free, with a barrier (not diagonally)
+ * next to them which has a free cell on either side. Paths only need to
+ * turn at subgoals, so searching the graph of subgoals is enough. Two are
+ * joined when one is directly h-reachable from the other: there's an
+ * octile path between them (diagonal moves, then straight ones) that
+ * doesn't go through any other subgoal. Edges cost the octile distance.
+ *
+ * For a query, start and goal are joined to the subgoals they directly
+ * reach, the graph is searched with A*, and every edge of the result is
+ * expanded back into cells.
+ *
+ * Every subgoal remembers the area its edges were found in. When a cell
+ * is toggled, only the subgoals around it can appear or disappear, and
+ * only the edges of the subgoals whose area includes them can change.
+ */
+#include "subgoal.h"
+#include "heap.h"
+#include "grid.h"
+#include "cost.h"
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <math.h>
+#include <time.h>
+
+extern int n_rows;
+extern int n_cols;
+extern bool horizontal_movement;
+
+#define NO_SUBGOAL -1
+// The extra target of an exploration: the other end of a query
+#define EXTRA -2
+
+typedef struct Subgoal {
+	Coordinates coord;
+	int *out;  // Subgoals it directly reaches
+	int n_out;
+	int out_cap;
+	int *in;   // Subgoals that directly reach it
+	int n_in;
+	int in_cap;
+	int x0, y0, x1, y1;  // Area read when its edges were found
+	bool alive;
+} Subgoal;
+
+typedef struct Exploration {
+	int extra;  // Cell also taken as a target, -1 if none
+	int *found;
+	int n_found;
+	int cap;
+	int x0, y0, x1, y1;
+} Exploration;
+
+static const int diagonals[4][2] = {{1, 1}, {1, -1}, {-1, 1}, {-1, -1}};
+static const int cardinals[4][2] = {{1, 0}, {-1, 0}, {0, 1}, {0, -1}};
+
+static bool enabled = false;
+static int *subgoal_at;  // Subgoal of each cell, NO_SUBGOAL if none
+static Subgoal *subgoals;
+static int n_ids;
+static int ids_cap;
+static int *free_ids;
+static int n_free;
+static SubgoalStats stats;
+static Exploration edges = {.extra = -1};
+
+// Search state of each thread
+static _Thread_local Node *nodes;
+static _Thread_local int *touched;
+static _Thread_local int n_touched;
+static _Thread_local unsigned *linked;  // To the goal, if it's the query's
+static _Thread_local unsigned query;
+static _Thread_local int nodes_cap;
+static _Thread_local Heap open;
+static _Thread_local Exploration from_start;
+static _Thread_local Exploration from_goal;
+static _Thread_local Path path;
+static _Thread_local int path_capacity;
+
+static inline bool blocked(int x, int y){
+	return x < 0 || x >= n_cols || y < 0 || y >= n_rows || grid_get(x, y);
+}
+
+static inline double octile(Coordinates a, Coordinates b){
+	int dx = abs(a.x - b.x);
+	int dy = abs(a.y - b.y);
+	return dx > dy ? dx - dy + M_SQRT2 * dy : dy - dx + M_SQRT2 * dx;
+}
+
+static bool is_corner(int x, int y){
+	if (blocked(x, y)){
+		return false;
+	}
+	for (int c = 0; c < 4; c++){
+		int cx = cardinals[c][0];
+		int cy = cardinals[c][1];
+		int bx = x + cx;
+		int by = y + cy;
+		if (bx < 0 || bx >= n_cols || by < 0 || by >= n_rows || !grid_get(bx, by)){
+			continue;
+		}
+		// The barrier ends on either side
+		if (!blocked(bx + cy, by + cx) || !blocked(bx - cy, by - cx)){
+			return true;
+		}
+	}
+	return false;
+}
+
+static int list_add(int **list, int *n, int *cap, int value){
+	if (*n == *cap){
+		int size = *cap ? *cap * 2 : 8;
+		int *tmp = realloc(*list, sizeof(int) * size);
+		if (!tmp){
+			return -1;
+		}
+		*list = tmp;
+		*cap = size;
+	}
+	(*list)[(*n)++] = value;
+	return 1;
+}
+
+static void list_remove(int *list, int *n, int value){
+	for (int i = 0; i < *n; i++){
+		if (list[i] == value){
+			list[i] = list[--(*n)];
+			return;
+		}
+	}
+}
+
+static void see(Exploration *e, int x, int y){
+	x = x < 0 ? 0 : x >= n_cols ? n_cols - 1 : x;
+	y = y < 0 ? 0 : y >= n_rows ? n_rows - 1 : y;
+	e->x0 = x < e->x0 ? x : e->x0;
+	e->y0 = y < e->y0 ? y : e->y0;
+	e->x1 = x > e->x1 ? x : e->x1;
+	e->y1 = y > e->y1 ? y : e->y1;
+}
+
+/**
+ * Free steps from (x, y) along (dx, dy), at most limit + 1, before a
+ * barrier or a target. *hit is set to the target right after them.
+ */
+static int clear_steps(Exploration *e, int x, int y, int dx, int dy, int limit, int *hit){
+	*hit = NO_SUBGOAL;
+	int k = 0;
+	while (k <= limit){
+		int nx = x + (k + 1) * dx;
+		int ny = y + (k + 1) * dy;
+		see(e, nx, ny);
+		if (blocked(nx, ny)){
+			break;
+		}
+		int cell = ny * n_cols + nx;
+		int target = cell == e->extra ? EXTRA : subgoal_at[cell];
+		if (target != NO_SUBGOAL){
+			*hit = target;
+			break;
+		}
+		k++;
+	}
+	return k;
+}
+
+/**
+ * Finds the targets directly h-reachable from (x, y): straight along
+ * each direction, and in each diagonal wedge, moving diagonally first
+ * and then straight, while the straight walks can only get shorter.
+ */
+static int explore(Exploration *e, int x, int y){
+	e->n_found = 0;
+	e->x0 = e->x1 = x;
+	e->y0 = e->y1 = y;
+	int hit;
+	for (int c = 0; c < 4; c++){
+		clear_steps(e, x, y, cardinals[c][0], cardinals[c][1], INT_MAX - 1, &hit);
+		if (hit != NO_SUBGOAL && list_add(&e->found, &e->n_found, &e->cap, hit) != 1){
+			return -1;
+		}
+	}
+	for (int d = 0; d < 4; d++){
+		int dx = diagonals[d][0];
+		int dy = diagonals[d][1];
+		int max_x = clear_steps(e, x, y, dx, 0, INT_MAX - 1, &hit);
+		int max_y = clear_steps(e, x, y, 0, dy, INT_MAX - 1, &hit);
+		int diagonal = clear_steps(e, x, y, dx, dy, INT_MAX - 1, &hit);
+		if (hit != NO_SUBGOAL && list_add(&e->found, &e->n_found, &e->cap, hit) != 1){
+			return -1;
+		}
+		for (int i = 1; i <= diagonal; i++){
+			int cx = x + i * dx;
+			int cy = y + i * dy;
+			int j = clear_steps(e, cx, cy, dx, 0, max_x, &hit);
+			if (j <= max_x && hit != NO_SUBGOAL){
+				if (list_add(&e->found, &e->n_found, &e->cap, hit) != 1){
+					return -1;
+				}
+				j--;
+			}
+			max_x = j < max_x ? j : max_x;
+			j = clear_steps(e, cx, cy, 0, dy, max_y, &hit);
+			if (j <= max_y && hit != NO_SUBGOAL){
+				if (list_add(&e->found, &e->n_found, &e->cap, hit) != 1){
+					return -1;
+				}
+				j--;
+			}
+			max_y = j < max_y ? j : max_y;
+		}
+	}
+	return 1;
+}
+
+static void clear_edges(int id){
+	Subgoal *s = &subgoals[id];
+	for (int i = 0; i < s->n_out; i++){
+		Subgoal *t = &subgoals[s->out[i]];
+		list_remove(t->in, &t->n_in, id);
+	}
+	stats.n_edges -= s->n_out;
+	s->n_out = 0;
+}
+
+static int connect(int id){
+	Subgoal *s = &subgoals[id];
+	if (explore(&edges, s->coord.x, s->coord.y) != 1){
+		return -1;
+	}
+	s->x0 = edges.x0;
+	s->y0 = edges.y0;
+	s->x1 = edges.x1;
+	s->y1 = edges.y1;
+	for (int i = 0; i < edges.n_found; i++){
+		Subgoal *t = &subgoals[edges.found[i]];
+		if (list_add(&s->out, &s->n_out, &s->out_cap, edges.found[i]) != 1
+		    || list_add(&t->in, &t->n_in, &t->in_cap, id) != 1){
+			return -1;
+		}
+	}
+	stats.n_edges += edges.n_found;
+	return 1;
+}
+
+static int add_subgoal(int x, int y){
+	int id;
+	if (n_free > 0){
+		id = free_ids[--n_free];
+	}else{
+		if (n_ids == ids_cap){
+			int cap = ids_cap ? ids_cap * 2 : 1024;
+			Subgoal *tmp = realloc(subgoals, sizeof(Subgoal) * cap);
+			if (!tmp){
+				return -1;
+			}
+			subgoals = tmp;
+			int *ids = realloc(free_ids, sizeof(int) * cap);
+			if (!ids){
+				return -1;
+			}
+			free_ids = ids;
+			ids_cap = cap;
+		}
+		id = n_ids++;
+		subgoals[id] = (Subgoal){0};
+	}
+	Subgoal *s = &subgoals[id];
+	s->coord = (Coordinates){x, y};
+	s->n_out = 0;
+	s->n_in = 0;
+	s->alive = true;
+	subgoal_at[y * n_cols + x] = id;
+	stats.n_subgoals++;
+	return id;
+}
+
+static void remove_subgoal(int id){
+	Subgoal *s = &subgoals[id];
+	clear_edges(id);
+	s->n_in = 0;
+	s->alive = false;
+	subgoal_at[s->coord.y * n_cols + s->coord.x] = NO_SUBGOAL;
+	stats.n_subgoals--;
+	// Always fits, there are never more free ids than ids
+	free_ids[n_free++] = id;
+}
+
+static void release(void){
+	for (int i = 0; i < n_ids; i++){
+		free(subgoals[i].out);
+		free(subgoals[i].in);
+	}
+	free(subgoals);
+	free(subgoal_at);
+	free(free_ids);
+	free(edges.found);
+	edges = (Exploration){.extra = -1};
+	subgoals = NULL;
+	subgoal_at = NULL;
+	free_ids = NULL;
+	n_ids = 0;
+	ids_cap = 0;
+	n_free = 0;
+}
+
+/**
+ * Drops the graph after running out of memory,
+ * so the queries fall back to find_path.
+ */
+static void disable(void){
+	release();
+	enabled = false;
+}
+
+static double now_seconds(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Builds the graph of the whole grid from scratch,
+ * if subgoal_init was called.
+ */
+void subgoal_build(void){
+	if (!enabled){
+		return;
+	}
+	double start = now_seconds();
+	release();
+	long n_cells = (long)n_rows * n_cols;
+	subgoal_at = malloc(sizeof(int) * n_cells);
+	if (!subgoal_at){
+		disable();
+		return;
+	}
+	stats = (SubgoalStats){0};
+	for (long i = 0; i < n_cells; i++){
+		subgoal_at[i] = NO_SUBGOAL;
+	}
+	for (int y = 0; y < n_rows; y++){
+		for (int x = 0; x < n_cols; x++){
+			if (is_corner(x, y) && add_subgoal(x, y) < 0){
+				disable();
+				return;
+			}
+		}
+	}
+	for (int id = 0; id < n_ids; id++){
+		if (connect(id) != 1){
+			disable();
+			return;
+		}
+	}
+	stats.build_seconds = now_seconds() - start;
+}
+
+/**
+ * Builds the graph, and keeps it up to date
+ * with the grid from then on.
+ */
+int subgoal_init(void){
+	enabled = true;
+	subgoal_build();
+	return enabled ? 1 : -1;
+}
+
+void subgoal_free(void){
+	release();
+	enabled = false;
+}
+
+/**
+ * Updates the graph after (x, y) was toggled.
+ */
+void subgoal_update(int x, int y){
+	if (!enabled){
+		return;
+	}
+	int x0 = x > 0 ? x - 1 : 0;
+	int y0 = y > 0 ? y - 1 : 0;
+	int x1 = x + 1 < n_cols ? x + 1 : n_cols - 1;
+	int y1 = y + 1 < n_rows ? y + 1 : n_rows - 1;
+	// Only the 3x3 cells around it can change their corners
+	int added[9];
+	int n_added = 0;
+	for (int cy = y0; cy <= y1; cy++){
+		for (int cx = x0; cx <= x1; cx++){
+			int id = subgoal_at[cy * n_cols + cx];
+			bool corner = is_corner(cx, cy);
+			if (id != NO_SUBGOAL && !corner){
+				remove_subgoal(id);
+			}
+		}
+	}
+	// The ids freed above are not reused until the edges that
+	// may still point to them are found again below
+	int released = n_free;
+	n_free = 0;
+	for (int cy = y0; cy <= y1; cy++){
+		for (int cx = x0; cx <= x1; cx++){
+			if (subgoal_at[cy * n_cols + cx] == NO_SUBGOAL && is_corner(cx, cy)){
+				int id = add_subgoal(cx, cy);
+				if (id < 0){
+					disable();
+					return;
+				}
+				added[n_added++] = id;
+			}
+		}
+	}
+	for (int id = 0; id < n_ids; id++){
+		Subgoal *s = &subgoals[id];
+		bool is_new = false;
+		for (int i = 0; i < n_added; i++){
+			is_new |= added[i] == id;
+		}
+		if (!s->alive || (!is_new && (s->x1 < x0 || s->x0 > x1 || s->y1 < y0 || s->y0 > y1))){
+			continue;
+		}
+		clear_edges(id);
+		if (connect(id) != 1){
+			disable();
+			return;
+		}
+	}
+	n_free = released;
+}
+
+/**
+ * Whether the graph can be searched. Its edges
+ * ignore the costs, so they must all be the same.
+ */
+bool subgoal_ready(void){
+	return enabled && cost_uniform();
+}
+
+SubgoalStats subgoal_stats(void){
+	return stats;
+}
+
+void subgoal_thread_free(void){
+	free(nodes);
+	free(touched);
+	free(linked);
+	free(open.elements);
+	free(from_start.found);
+	free(from_goal.found);
+	free(path.path);
+	nodes = NULL;
+	touched = NULL;
+	linked = NULL;
+	open.elements = NULL;
+	from_start = (Exploration){0};
+	from_goal = (Exploration){0};
+	path.path = NULL;
+	path_capacity = 0;
+	nodes_cap = 0;
+	n_touched = 0;
+}
+
+/**
+ * Grows the path of the thread to hold n cells, doubling it.
+ */
+static bool reserve_path(int n){
+	if (n <= path_capacity){
+		return true;
+	}
+	int capacity = path_capacity ? path_capacity * 2 : 256;
+	while (capacity < n){
+		capacity *= 2;
+	}
+	Coordinates *grown = realloc(path.path, sizeof(Coordinates) * capacity);
+	if (!grown){
+		return false;
+	}
+	path.path = grown;
+	path_capacity = capacity;
+	return true;
+}
+
+/**
+ * Sizes the search state of the thread for the current graph,
+ * plus the two nodes of the query, start and goal.
+ */
+static int reserve_nodes(void){
+	if (!reserve_path(1)){
+		return -1;
+	}
+	if (n_ids + 2 <= nodes_cap){
+		return 1;
+	}
+	int cap = (n_ids + 2) * 2;
+	Node *new_nodes = realloc(nodes, sizeof(Node) * cap);
+	if (!new_nodes){
+		return -1;
+	}
+	memset(new_nodes + nodes_cap, 0, sizeof(Node) * (cap - nodes_cap));
+	nodes = new_nodes;
+	int *new_touched = realloc(touched, sizeof(int) * cap);
+	unsigned *new_linked = realloc(linked, sizeof(unsigned) * cap);
+	Node **elements = realloc(open.elements, sizeof(Node*) * cap);
+	if (new_touched){
+		touched = new_touched;
+	}
+	if (new_linked){
+		memset(new_linked + nodes_cap, 0, sizeof(unsigned) * (cap - nodes_cap));
+		linked = new_linked;
+	}
+	if (elements){
+		open.elements = elements;
+	}
+	if (!new_touched || !new_linked || !elements){
+		return -1;
+	}
+	nodes_cap = cap;
+	return 1;
+}
+
+static void relax(Node *from, int index, Coordinates coord, Coordinates end){
+	Node *node = &nodes[index];
+	double g = from->g + octile(from->coord, coord);
+	if (!node->visited){
+		touched[n_touched++] = index;
+		*node = (Node){
+			.parent = from,
+			.coord = coord,
+			.visited = true,
+			.g = g,
+			.h = octile(coord, end),
+			.heap_index = -1
+		};
+		heap_add(&open, node);
+	}else if (!node->closed && g < node->g){
+		node->parent = from;
+		heap_change_priority(&open, node, g, node->h);
+	}
+}
+
+static bool free_line(Coordinates a, int dx, int dy, int n){
+	for (int i = 1; i <= n; i++){
+		if (blocked(a.x + i * dx, a.y + i * dy)){
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+ * Appends the cells from a (excluded) to b, which is directly
+ * h-reachable from it: diagonally and then straight, or the other
+ * way around, depending on which end its edge was found from.
+ */
+static bool append_segment(Coordinates a, Coordinates b){
+	int dx = (b.x > a.x) - (b.x < a.x);
+	int dy = (b.y > a.y) - (b.y < a.y);
+	int adx = abs(b.x - a.x);
+	int ady = abs(b.y - a.y);
+	int diagonal = adx < ady ? adx : ady;
+	int straight = abs(adx - ady);
+	int sx = adx > ady ? dx : 0;
+	int sy = adx > ady ? 0 : dy;
+	Coordinates corner = {a.x + diagonal * dx, a.y + diagonal * dy};
+	bool diagonal_first = free_line(a, dx, dy, diagonal) && free_line(corner, sx, sy, straight);
+	if (!diagonal_first){
+		corner = (Coordinates){a.x + straight * sx, a.y + straight * sy};
+		if (!free_line(a, sx, sy, straight) || !free_line(corner, dx, dy, diagonal)){
+			return false;
+		}
+	}
+	if (!reserve_path(path.path_length + diagonal + straight)){
+		return false;
+	}
+	Coordinates c = a;
+	for (int i = 0; i < diagonal + straight; i++){
+		bool take_diagonal = diagonal_first ? i < diagonal : i >= straight;
+		c.x += take_diagonal ? dx : sx;
+		c.y += take_diagonal ? dy : sy;
+		path.path[path.path_length++] = c;
+	}
+	return true;
+}
+
+/**
+ * Turns the chain of nodes that ends at goal into cells,
+ * from start to end like find_path's.
+ */
+static bool expand_path(Node *goal){
+	path.path_length = 0;
+	Node *chain = NULL;
+	// Reverse the chain, through the parents, to walk it from start
+	for (Node *n = goal; n;){
+		Node *parent = n->parent;
+		n->parent = chain;
+		chain = n;
+		n = parent;
+	}
+	path.path[path.path_length++] = chain->coord;
+	for (Node *n = chain; n->parent; n = n->parent){
+		if (!append_segment(n->coord, n->parent->coord)){
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+ * Optimal 8-connected path (for an agent of size 1) over the subgoal
+ * graph. Like find_path's, the path goes from start to end, and only
+ * holds end if there's none. The turns are not penalized, so it may be
+ * another path of the same cost. Falls back to find_path without the
+ * graph, or with 4-connected movement.
+ * The Path is only valid until the next call from this thread.
+ */
+Path find_path_subgoal(Coordinates start, Coordinates end){
+	if (!enabled || !horizontal_movement || blocked(start.x, start.y)
+	    || blocked(end.x, end.y) || reserve_nodes() != 1){
+		return find_path(start, end, NULL, 1);
+	}
+	path.bound = 1.0;
+	if (start.x == end.x && start.y == end.y){
+		path.path[0] = end;
+		path.path_length = 1;
+		return path;
+	}
+	for (int i = 0; i < n_touched; i++){
+		nodes[touched[i]].visited = false;
+		nodes[touched[i]].closed = false;
+	}
+	n_touched = 0;
+	open.n_elements = 0;
+	query++;
+
+	int start_node = n_ids;
+	int goal_node = n_ids + 1;
+	int start_id = subgoal_at[start.y * n_cols + start.x];
+	int goal_id = subgoal_at[end.y * n_cols + end.x];
+	from_start.extra = end.y * n_cols + end.x;
+	from_goal.extra = start.y * n_cols + start.x;
+	if (explore(&from_start, start.x, start.y) != 1 || explore(&from_goal, end.x, end.y) != 1){
+		return find_path(start, end, NULL, 1);
+	}
+	bool direct = false;
+	for (int i = 0; i < from_goal.n_found; i++){
+		if (from_goal.found[i] == EXTRA){
+			direct = true;
+		}else{
+			linked[from_goal.found[i]] = query;
+		}
+	}
+	if (goal_id != NO_SUBGOAL){
+		linked[goal_id] = query;
+	}
+
+	Node *node = &nodes[start_node];
+	*node = (Node){.coord = start, .visited = true, .h = octile(start, end), .heap_index = -1};
+	touched[n_touched++] = start_node;
+	heap_add(&open, node);
+	while (open.n_elements > 0){
+		node = heap_pop(&open);
+		node->closed = true;
+		int index = node - nodes;
+		if (index == goal_node){
+			break;
+		}
+		// The neighbours of start are the ones it reaches, and its own if it's a subgoal
+		int id = index == start_node ? start_id : index;
+		if (index == start_node){
+			for (int i = 0; i < from_start.n_found; i++){
+				int t = from_start.found[i];
+				if (t == EXTRA || t == goal_id){
+					relax(node, goal_node, end, end);
+				}else{
+					relax(node, t, subgoals[t].coord, end);
+				}
+			}
+			if (direct){
+				relax(node, goal_node, end, end);
+			}
+		}
+		if (id != NO_SUBGOAL){
+			Subgoal *s = &subgoals[id];
+			for (int k = 0; k < 2; k++){
+				int *list = k == 0 ? s->out : s->in;
+				int n = k == 0 ? s->n_out : s->n_in;
+				for (int i = 0; i < n; i++){
+					if (list[i] == start_id){
+						continue;
+					}
+					if (list[i] == goal_id){
+						relax(node, goal_node, end, end);
+					}else{
+						relax(node, list[i], subgoals[list[i]].coord, end);
+					}
+				}
+			}
+			if (linked[id] == query){
+				relax(node, goal_node, end, end);
+			}
+		}
+	}
+	if (!nodes[goal_node].visited){
+		path.path[0] = end;
+		path.path_length = 1;
+		return path;
+	}
+	if (!expand_path(&nodes[goal_node])){
+		return find_path(start, end, NULL, 1);
+	}
+	return path;
+}
@@ -0,0 +1,27 @@
+/**
+ * Simple subgoal graph, for optimal 8-connected searches.
+ */
+#ifndef SUBGOAL_H
+#define SUBGOAL_H
+
+#include "path_finding.h"
+
+typedef struct SubgoalStats {
+	int n_subgoals;
+	long n_edges;
+	double build_seconds;
+} SubgoalStats;
+
+int subgoal_init(void);
+void subgoal_free(void);
+void subgoal_thread_free(void);
+
+void subgoal_build(void);
+void subgoal_update(int x, int y);
+
+bool subgoal_ready(void);
+SubgoalStats subgoal_stats(void);
+
+Path find_path_subgoal(Coordinates start, Coordinates end);
+
+#endif // SUBGOAL_H
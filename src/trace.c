@@ -0,0 +1,215 @@
+/**
+ * Timeline tracing.
+ * A span is stored when it ends, as a complete event, so a full ring
+ * loses whole spans, the oldest first. The buffers are kept in a list
+ * until the trace is written, after their threads are gone too, but
+ * the buffer of a thread that exits is taken by the next thread that
+ * needs one, preferably of the same name, so there are only as many
+ * buffers as threads were ever running at once, not started. A buffer
+ * can then hold the spans of several threads, one after the other.
+ */
+#include "trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+
+typedef struct TraceEvent {
+	const char *name;
+	uint64_t start_ns;
+	uint64_t duration_ns;
+} TraceEvent;
+
+typedef struct TraceBuffer {
+	struct TraceBuffer *next;
+	const char *name;      // Of its thread
+	int id;
+	int depth;             // Of the spans open, recorded or not
+	bool unused;           // Its thread exited
+	const char *open_names[TRACE_DEPTH];
+	uint64_t open_starts[TRACE_DEPTH];
+	uint64_t n_events;     // Ever recorded, the ring has the last ones
+	TraceEvent events[TRACE_EVENTS];
+} TraceBuffer;
+
+bool trace_enabled = false;
+static FILE *out = NULL;
+static const char *out_name;
+static uint64_t origin_ns;
+static pthread_mutex_t buffers_lock = PTHREAD_MUTEX_INITIALIZER;
+static TraceBuffer *buffers = NULL;
+static int n_buffers = 0;
+static _Thread_local TraceBuffer *buffer = NULL;
+static _Thread_local bool no_buffer = false;
+static _Thread_local const char *thread_name = NULL;
+// Gives the buffer of a thread back when it exits
+static pthread_key_t buffer_key;
+
+static uint64_t now_ns(void){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void release_buffer(void *b){
+	pthread_mutex_lock(&buffers_lock);
+	((TraceBuffer*)b)->unused = true;
+	pthread_mutex_unlock(&buffers_lock);
+}
+
+/**
+ * Buffer left by a thread that exited, of the same name if there's one.
+ * Must be called with the lock held.
+ */
+static TraceBuffer* unused_buffer(void){
+	TraceBuffer *found = NULL;
+	for (TraceBuffer *b = buffers; b; b = b->next){
+		if (b->unused && (!found || b->name == thread_name)){
+			found = b;
+		}
+	}
+	return found;
+}
+
+/**
+ * Buffer of the calling thread, taken on its first span.
+ * If it can't be allocated, the thread is left out of the trace.
+ */
+static TraceBuffer* thread_buffer(void){
+	if (buffer || no_buffer){
+		return buffer;
+	}
+	pthread_mutex_lock(&buffers_lock);
+	TraceBuffer *b = unused_buffer();
+	if (!b){
+		b = malloc(sizeof(*b));
+		if (!b){
+			pthread_mutex_unlock(&buffers_lock);
+			no_buffer = true;
+			return NULL;
+		}
+		b->id = ++n_buffers;
+		b->n_events = 0;
+		b->next = buffers;
+		buffers = b;
+	}
+	b->name = thread_name;
+	b->depth = 0;
+	b->unused = false;
+	pthread_mutex_unlock(&buffers_lock);
+	pthread_setspecific(buffer_key, b);
+	buffer = b;
+	return buffer;
+}
+
+void trace_push(const char *name){
+	TraceBuffer *b = thread_buffer();
+	if (!b){
+		return;
+	}
+	if (b->depth < TRACE_DEPTH){
+		b->open_names[b->depth] = name;
+		b->open_starts[b->depth] = now_ns();
+	}
+	b->depth++;
+}
+
+void trace_pop(void){
+	TraceBuffer *b = buffer;
+	if (!b || b->depth == 0){
+		return;
+	}
+	b->depth--;
+	if (b->depth >= TRACE_DEPTH){
+		return;
+	}
+	TraceEvent *e = &b->events[b->n_events++ % TRACE_EVENTS];
+	e->name = b->open_names[b->depth];
+	e->start_ns = b->open_starts[b->depth];
+	e->duration_ns = now_ns() - e->start_ns;
+}
+
+/**
+ * Names the calling thread in the trace.
+ * name must outlive the trace, like a string literal.
+ */
+void trace_thread_name(const char *name){
+	thread_name = name;
+	if (buffer){
+		buffer->name = name;
+	}
+}
+
+/**
+ * Starts recording the spans of every thread, to be written
+ * to filename by trace_stop. The calling thread is the main one.
+ */
+int trace_start(const char *filename){
+	out = fopen(filename, "w");
+	if (!out){
+		return -1;
+	}
+	if (pthread_key_create(&buffer_key, release_buffer) != 0){
+		fclose(out);
+		out = NULL;
+		return -1;
+	}
+	out_name = filename;
+	origin_ns = now_ns();
+	trace_thread_name("main");
+	trace_enabled = true;
+	return 1;
+}
+
+static void write_events(TraceBuffer *b, bool *first){
+	if (b->name){
+		fprintf(out, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+			*first ? "" : ",\n", b->id, b->name);
+		*first = false;
+	}
+	uint64_t n = b->n_events < TRACE_EVENTS ? b->n_events : TRACE_EVENTS;
+	for (uint64_t i = b->n_events - n; i < b->n_events; i++){
+		const TraceEvent *e = &b->events[i % TRACE_EVENTS];
+		fprintf(out, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+			*first ? "" : ",\n", e->name, b->id,
+			(e->start_ns - origin_ns) / 1e3, e->duration_ns / 1e3);
+		*first = false;
+	}
+}
+
+/**
+ * Writes the trace and stops recording. The other threads must
+ * be done with their spans. Spans still open are left out.
+ */
+void trace_stop(void){
+	if (!trace_enabled){
+		return;
+	}
+	trace_enabled = false;
+	// The buffers are freed, so the threads can't give theirs back
+	pthread_key_delete(buffer_key);
+	uint64_t n_spans = 0;
+	uint64_t n_lost = 0;
+	bool first = true;
+	fprintf(out, "{\"traceEvents\":[\n");
+	while (buffers){
+		TraceBuffer *b = buffers;
+		buffers = b->next;
+		write_events(b, &first);
+		n_spans += b->n_events;
+		if (b->n_events > TRACE_EVENTS){
+			n_lost += b->n_events - TRACE_EVENTS;
+		}
+		free(b);
+	}
+	fprintf(out, "\n],\"displayTimeUnit\":\"ms\"}\n");
+	buffer = NULL;
+	if (fclose(out) != 0){
+		fprintf(stderr, "Error writing the trace to %s\n", out_name);
+	}else{
+		fprintf(stderr, "Trace of %d thread buffers written to %s: %lu spans, %lu overwritten\n",
+			n_buffers, out_name, (unsigned long)n_spans, (unsigned long)n_lost);
+	}
+	out = NULL;
+}
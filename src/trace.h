@@ -0,0 +1,46 @@
+/**
+ * Timeline of what the program does, in the Chrome trace format
+ * (chrome://tracing, Perfetto), to see when the searches and the
+ * drawing happen relative to each other, and on which threads.
+ *
+ * A span goes from trace_begin to the trace_end that matches it,
+ * and spans nest. Each thread stores its spans in its own ring
+ * buffer, so they are recorded without locks, and only the last
+ * TRACE_EVENTS of each thread are kept. While tracing is off,
+ * a span costs a test of trace_enabled.
+ */
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdbool.h>
+
+#define TRACE_EVENTS (1 << 16)
+// Spans nested deeper than this are not recorded
+#define TRACE_DEPTH 32
+
+extern bool trace_enabled;
+
+void trace_push(const char *name);
+void trace_pop(void);
+
+/**
+ * Starts a span. name must outlive the trace,
+ * like a string literal.
+ */
+static inline void trace_begin(const char *name){
+	if (trace_enabled){
+		trace_push(name);
+	}
+}
+
+static inline void trace_end(void){
+	if (trace_enabled){
+		trace_pop();
+	}
+}
+
+int trace_start(const char *filename);
+void trace_stop(void);
+void trace_thread_name(const char *name);
+
+#endif // TRACE_H